@@ -1,26 +1,34 @@
 #pragma once
 
+#include <vector>
+
+#include "atomkey.h"
 #include "util.h" 
 #include "physicsparameters.h"
 
 class Atom 
 {
 public:
-    Atom(const PhysicsParameters& params, float x, float y, char type, int state)
-        :params(params),x(x),y(y),type(type),state(state)
+    Atom(const PhysicsParameters& params, float x, float y, int type, int state)
+        :key(atom_key(type,state)),params(params),x(x),y(y)
     {
         //vx += randf(-10,10);
         //vy += randf(-10,10);      
     };
     
-    void update() {        // TODO: add delta parameter
+    // damping and kick are the friction and Brownian velocity change for one step of dt
+    template<Boundary B>
+    void update(Random& random, float dt, float damping, float kick) {
         // Brownian motion
-        vx += randf(-params.temp,params.temp);
-        vy += randf(-params.temp,params.temp);      
-        vx -= (vx * params.friction);
-        vy -= (vy * params.friction);
-        x += vx;
-        y += vy;
+        vx += random.randf(-kick,kick);
+        vy += random.randf(-kick,kick);      
+        vx -= (vx * damping);
+        vy -= (vy * damping);
+        // with Verlet, the atom was already moved with the bond forces
+        if (params.integrator == Integrator::euler) {
+            x += vx * dt;
+            y += vy * dt;
+        }
         if (correction_n>0) {
             x += correction_x / correction_n;
             y += correction_y / correction_n;
@@ -28,15 +36,53 @@ public:
             correction_y = 0;
             correction_n = 0;
         }
-        if (x<params.atom_radius && vx<0) {vx=-vx; x=params.atom_radius+vx/2;}
-        if (y<params.atom_radius && vy<0) {vy=-vy; y=params.atom_radius+vy/2;}
-        if (x>params.space_width-params.atom_radius && vx>0) {vx=-vx; x=params.space_width-params.atom_radius+vx/2;}
-        if (y>params.space_height-params.atom_radius && vy>0) {vy=-vy; y=params.space_height-params.atom_radius+vy/2;}
+        if constexpr (B == Boundary::reflect) {
+            if (x<params.atom_radius && vx<0) {vx=-vx; x=params.atom_radius+vx*dt/2;}
+            if (y<params.atom_radius && vy<0) {vy=-vy; y=params.atom_radius+vy*dt/2;}
+            if (x>params.space_width-params.atom_radius && vx>0) {vx=-vx; x=params.space_width-params.atom_radius+vx*dt/2;}
+            if (y>params.space_height-params.atom_radius && vy>0) {vy=-vy; y=params.space_height-params.atom_radius+vy*dt/2;}
+        }
+        else if constexpr (B == Boundary::periodic) {
+            wrap();
+        }
+        // Boundary::open: atoms that are off_world() are removed by the owner
     }
 
+    void wrap() {
+        x = wrap_coordinate(x, params.space_width);
+        y = wrap_coordinate(y, params.space_height);
+    }
+
+    template<Boundary B>
     bool collide(Atom& other) {
-        float dx = other.x - x;
-        float dy = other.y - y;
+        float dvx, dvy, correct_x, correct_y;
+        if (!collision<B>(other, dvx, dvy, correct_x, correct_y)) return false;
+        vx -= dvx;
+        vy -= dvy;
+        other.vx += dvx;
+        other.vy += dvy;
+        correction_n += 1;
+        correction_x -= correct_x;
+        correction_y -= correct_y;
+        other.correction_n += 1;
+        other.correction_x += correct_x;
+        other.correction_y += correct_y;
+        return true;
+    };
+
+    // the change of velocity and position of this atom by a collision with other, if they overlap;
+    // other gets the opposite 
+    template<Boundary B>
+    bool collision(const Atom& other, float& dvx, float& dvy, float& correct_x, float& correct_y) const {
+        return collision<B>(params, x, y, vx, vy, other.x, other.y, other.vx, other.vy, dvx, dvy, correct_x, correct_y);
+    }
+
+    // the same for an atom at (x, y) with velocity (vx, vy) and another one at (ox, oy) with (ovx, ovy)
+    template<Boundary B>
+    static bool collision(const PhysicsParameters& params, float x, float y, float vx, float vy, float ox, float oy, float ovx, float ovy,
+                          float& dvx, float& dvy, float& correct_x, float& correct_y) {
+        float dx = boundary_delta<B>(ox - x, params.space_width);
+        float dy = boundary_delta<B>(oy - y, params.space_height);
         float d2 = dx*dx + dy*dy;
         float diameter = 2* params.atom_radius;
         if (d2 < diameter * diameter) {
@@ -44,31 +90,21 @@ public:
             float nx = dx/d;
             float ny = dy/d;
             // elastic collision
-            float dvx_elastic = -nx * ((vx-other.vx)*(x-other.x) + (vy-other.vy)*(y-other.y)) / d;
-            float dvy_elastic = -ny * ((vx-other.vx)*(x-other.x) + (vy-other.vy)*(y-other.y)) / d;
+            float dvx_elastic = nx * ((vx-ovx)*dx + (vy-ovy)*dy) / d;
+            float dvy_elastic = ny * ((vx-ovx)*dx + (vy-ovy)*dy) / d;
             // inelastic collision
-            float dvx_inelastic = vx - (vx + other.vx) / 2;
-            float dvy_inelastic = vy - (vy + other.vy) / 2;
+            float dvx_inelastic = vx - (vx + ovx) / 2;
+            float dvy_inelastic = vy - (vy + ovy) / 2;
             // apply collision
-            float dvx = dvx_elastic * params.collision_elasticity + dvx_inelastic * (1-params.collision_elasticity);
-            float dvy = dvy_elastic * params.collision_elasticity + dvy_inelastic * (1-params.collision_elasticity);
-            vx -= dvx;
-            vy -= dvy;
-            other.vx += dvx;
-            other.vy += dvy;
+            dvx = dvx_elastic * params.collision_elasticity + dvx_inelastic * (1-params.collision_elasticity);
+            dvy = dvy_elastic * params.collision_elasticity + dvy_inelastic * (1-params.collision_elasticity);
             // move apart
-            float correct_x = nx * (diameter - d)/2; 
-            float correct_y = ny * (diameter - d)/2;
-            correction_n += 1;
-            correction_x -= correct_x;
-            correction_y -= correct_y;
-            other.correction_n += 1;
-            other.correction_x += correct_x;
-            other.correction_y += correct_y;
+            correct_x = nx * (diameter - d)/2; 
+            correct_y = ny * (diameter - d)/2;
             return true;
         }
         return false;
-    };
+    }
 
     bool off_world() { 
             return x < params.atom_radius 
@@ -80,20 +116,38 @@ public:
 
     // variables
     
-    char type;
-    int state;
+    AtomKey key;            // type and state
+    int type() const { return key_type(key); }
+    int state() const { return key_state(key); }
 
     const PhysicsParameters& params;
     float x;
     float y;
     float vx = 0;
     float vy = 0;
+    float ax = 0;           // acceleration by bonds, for Verlet
+    float ay = 0;
     float correction_x = 0;
     float correction_y = 0;
     int correction_n = 0;
     
     int spacemap_index = -1; // index in the spacemap, -1 if not in spacemap
+    int index = -1;          // index in the atoms vector
+    int id = -1;             // unique in the world and stable, unlike index
+    int slot = -1;           // in the world's handle table, see AtomHandle
+    bool ghost = false;      // a copy of an atom of another domain, see domain.h
+    
+    // sleeping atoms are not moved, see World::update_sleeping()
+    bool sleeping = false;
+    int island = -1;        // island of bonded atoms this atom sleeps with
+    float motion = 0;       // smoothed squared speed
+    int quiet_steps = 0;    // steps since the atom was last moving or reacting
     int num_bonds = 0;
+
+    // molecule this atom is part of, see ClusterTracker
+    int cluster = -1;
+    std::vector<Atom*> neighbours;      // bonded atoms
+    unsigned search_mark = 0;
     
 };
 
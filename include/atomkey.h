@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+
+// The type and state of an atom packed into 16 bits, the type in the high byte. Everything
+// that is per type and state (the atoms, the rule table, the renderer's textures and the
+// population counts) is indexed by this key.
+using AtomKey = uint16_t;
+
+constexpr int max_types = 64;
+constexpr int max_states = 256;
+constexpr int num_keys = max_types << 8;        // keys are below this
+
+constexpr AtomKey atom_key(int type, int state) {
+    return (AtomKey)(type << 8 | state);
+}
+
+constexpr int key_type(AtomKey key) {
+    return key >> 8;
+}
+
+constexpr int key_state(AtomKey key) {
+    return key & 0xff;
+}
+
+// Types are written a to z, and from 26 on as a number in brackets, e.g. [26]; in rules, X and Y
+// are wildcards.
+inline std::string type_name(int type) {
+    if (type < 26) return std::string(1, char('a' + type));
+    return "[" + std::to_string(type) + "]";
+}
+
+// the type written at text[i], which i is moved past; -1 if there is none
+inline int parse_type(const std::string& text, size_t& i) {
+    if (i >= text.size()) return -1;
+    if (text[i] >= 'a' && text[i] <= 'z') return text[i++] - 'a';
+    if (text[i] != '[') return -1;
+    size_t end = text.find(']', i);
+    if (end == std::string::npos || end == i+1 || end > i+3) return -1;
+    int type = 0;
+    for (size_t j=i+1;j<end;++j) {
+        if (!std::isdigit(text[j])) return -1;
+        type = type * 10 + (text[j] - '0');
+    }
+    if (type >= max_types) return -1;
+    i = end + 1;
+    return type;
+}
+
+// the key written as type and state, e.g. a0 or [30]12
+inline std::string key_name(AtomKey key) {
+    return type_name(key_type(key)) + std::to_string(key_state(key));
+}
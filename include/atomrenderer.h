@@ -4,11 +4,12 @@
 #include <SDL2/SDL_surface.h>
 #include <SDL2/SDL_ttf.h>
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <format>
-#include <map>
-#include <format>
+#include <mutex>
+#include <vector>
 
 #include "atom.h"
 
@@ -16,58 +17,54 @@
 class AtomRenderer
 {
 public:
-    AtomRenderer(SDL_Renderer& renderer): renderer(renderer)
+    AtomRenderer(SDL_Renderer& renderer): renderer(renderer), textures(num_keys, nullptr)
     {
-        // Initialize color map
-        color_map['a'] = {255,0,0,255};
-        color_map['b'] = {0,255,0,255};
-        color_map['c'] = {0,0,255,255};
-        color_map['d'] = {0,255,255,255};
-        color_map['e'] = {255,0,255,255};
-        color_map['f'] = {255,255,0,255};
-
-        // color_map['x'] = {128,128,128,255};     // debug
-
     }
     ~AtomRenderer() {
-        for (auto& [key, texture] : texture_map) {
-            SDL_DestroyTexture(texture);
+        for (SDL_Texture* texture : textures) {
+            if (texture) SDL_DestroyTexture(texture);
         }
-        texture_map.clear();
     };
 
     void draw(const Atom& atom, float scale, float offset_x, float offset_y) {
-        
-        TypeState ts {atom.type, atom.state};
-        SDL_Texture* texture = nullptr;
-
-        //debug
-        //if (atom.debug_missed) {
-        //    ts.type = 'x';
-        //}
+        draw(atom.key, atom.x, atom.y, scale, offset_x, offset_y);
+    }
 
-        auto it = texture_map.find(ts);
-        if (it != texture_map.end()) {
-            texture = it->second;
-        }
-        else {
-            std::cout << "creating texture for " << ts.type << ts.state << "\n";
-            SDL_Surface* surface = create_surface(ts.type, ts.state);
+    void draw(AtomKey key, float x, float y, float scale, float offset_x, float offset_y) {
+        
+        // one texture per key, made when it is first drawn
+        SDL_Texture*& texture = textures[key];
+        if (!texture) {
+            SDL_Surface* surface = create_surface(key);
             texture = SDL_CreateTextureFromSurface(&renderer, surface);
             SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
             SDL_FreeSurface(surface);
-            texture_map[ts] = texture;
         }
 
     
-        SDL_FRect tgt_rect = {offset_x+(atom.x-radius)*scale, offset_y+(atom.y-radius)*scale, 2*radius*scale, 2*radius*scale};  
+        SDL_FRect tgt_rect = {offset_x+(x-radius)*scale, offset_y+(y-radius)*scale, 2*radius*scale, 2*radius*scale};  
         SDL_RenderCopyF(&renderer, texture, nullptr, &tgt_rect); 
     }
 
-    SDL_Surface* create_surface(char type, int state) {
+    // The colour of a type: the first six are the primary and secondary colours, red, green, blue,
+    // cyan, magenta and yellow; the others have hues a golden angle apart, in lighter and darker shades.
+    static SDL_Color type_color(int type) {
+        static const float first_hues[] = {0, 120, 240, 180, 300, 60};
+        float hue = (type < 6) ? first_hues[type] : std::fmod(type * 137.508f, 360.0f);
+        float saturation = (type < 6) ? 1.0f : 0.75f;
+        float value = (type < 6 || (type / 6) % 2 == 1) ? 1.0f : 0.7f;
+        // HSV to RGB
+        auto channel = [&](float n) {
+            float k = std::fmod(n + hue / 60, 6.0f);
+            float amount = std::clamp(std::min(k, 4 - k), 0.0f, 1.0f);
+            return static_cast<Uint8>(std::lround(255 * value * (1 - saturation * amount)));
+        };
+        return {channel(5), channel(3), channel(1), 255};
+    }
+
+    SDL_Surface* create_surface(AtomKey key) {
         
-        // set color from type
-        SDL_Color color = color_map[type];
+        SDL_Color color = type_color(key_type(key));
                 
         // -- create surface and renderer
         
@@ -116,10 +113,12 @@ public:
         
         // -- draw text
         
+        // SDL_ttf is not thread safe, and atoms may be drawn on several threads, see FrameExporter
+        std::lock_guard<std::mutex> lock(font_mutex());
         TTF_Font* font = TTF_OpenFont("assets/FreeSans.ttf", 16);
         if (!font) { std::cout << "font not found\n"; return surface;}
         
-        std::string txt = std::format("{}{}",type,state);
+        std::string txt = key_name(key);
         
         SDL_Color fg_color {
             static_cast<Uint8>(255-color.r),
@@ -145,22 +144,17 @@ public:
 
 
 private:
-    
-    struct TypeState {
-        char type;
-        int state;
-        
-        bool operator<(const TypeState& other) const {
-            return std::tie(type, state) < std::tie(other.type, other.state);
-        }
-    };
 
+    static std::mutex& font_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    
     const float radius = 16;
     static constexpr int segments = 16;
     SDL_Renderer& renderer;
     SDL_Surface* surface;
-    std::map<char,SDL_Color> color_map;
-    std::map<TypeState,SDL_Texture*> texture_map;
+    std::vector<SDL_Texture*> textures;     // by key
 
     
 };
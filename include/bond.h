@@ -1,7 +1,6 @@
 #pragma once
 
 #include <memory>
-#include <SDL2/SDL.h>
 
 #include "atom.h"
 
@@ -10,6 +9,7 @@ struct Bond {
     std::shared_ptr<Atom> atom1;
     std::shared_ptr<Atom> atom2;
     const PhysicsParameters& params;
+    int index = -1;     // index in World::bonds
     
     Bond(const PhysicsParameters& params,std::shared_ptr<Atom> atom1, std::shared_ptr<Atom> atom2)
         :params(params),atom1(atom1),atom2(atom2)
@@ -23,34 +23,74 @@ struct Bond {
         atom2->num_bonds-=1;
     }
 
-    void update() {
-        float dx = atom2->x - atom1->x;
-        float dy = atom2->y - atom1->y;
+    template<Boundary B>
+    float length() const {
+        float dx = boundary_delta<B>(atom2->x - atom1->x, params.space_width);
+        float dy = boundary_delta<B>(atom2->y - atom1->y, params.space_height);
+        return sqrt(dx*dx + dy*dy);
+    }
+
+    // spring force on atom1; atom2 gets the opposite
+    template<Boundary B>
+    void force(float& fx, float& fy) const {
+        force<B>(*atom1, *atom2, fx, fy);
+    }
+
+    // the same for a bond between any two atoms
+    template<Boundary B>
+    static void force(const Atom& atom1, const Atom& atom2, float& fx, float& fy) {
+        force<B>(atom1.params, atom1.x, atom1.y, atom2.x, atom2.y, fx, fy);
+    }
+
+    // and between two atoms at (x1, y1) and (x2, y2)
+    template<Boundary B>
+    static void force(const PhysicsParameters& params, float x1, float y1, float x2, float y2, float& fx, float& fy) {
+        float dx = boundary_delta<B>(x2 - x1, params.space_width);
+        float dy = boundary_delta<B>(y2 - y1, params.space_height);
         float dist = sqrt(dx*dx + dy*dy);
         float force = (dist-params.bonding_distance) * params.bonding_strength;
-        atom1->vx += force * dx / dist;
-        atom1->vy += force * dy / dist;
-        atom2->vx -= force * dx / dist;
-        atom2->vy -= force * dy / dist;
+        fx = force * dx / dist;
+        fy = force * dy / dist;
+    }
+
+    // Euler: change the velocities for a step of dt
+    template<Boundary B>
+    void update(float dt) {
+        float fx, fy;
+        force<B>(fx, fy);
+        atom1->vx += fx * dt;
+        atom1->vy += fy * dt;
+        atom2->vx -= fx * dt;
+        atom2->vy -= fy * dt;
     };
 
-    void draw(SDL_Renderer& renderer, float scale, float offset_x, float offset_y) const {
-        SDL_SetRenderDrawColor(&renderer, 255, 255, 255, 255);
+    // Verlet: add to the accelerations
+    template<Boundary B>
+    void accelerate() {
+        float fx, fy;
+        force<B>(fx, fy);
+        atom1->ax += fx;
+        atom1->ay += fy;
+        atom2->ax -= fx;
+        atom2->ay -= fy;
+    }
+
+    // the line drawn for the bond, between the edges of the atoms; across the edge of a
+    // periodic world it is drawn from atom1 only
+    void line(float& x1, float& y1, float& x2, float& y2) const {
         float dx = atom2->x - atom1->x;
         float dy = atom2->y - atom1->y;
+        if (params.boundary == Boundary::periodic) {
+            dx = boundary_delta<Boundary::periodic>(dx, params.space_width);
+            dy = boundary_delta<Boundary::periodic>(dy, params.space_height);
+        }
         float d2 = dx * dx + dy * dy;
         float d = sqrt(d2) + 0.0001f; // avoid division by zero
         float nx = dx /d;
         float ny = dy /d; 
-        float x1 = atom1->x + (params.atom_radius/2) * nx;
-        float y1 = atom1->y + (params.atom_radius/2) * ny;
-        float x2 = atom2->x - (params.atom_radius/2) * nx;
-        float y2 = atom2->y - (params.atom_radius/2) * ny;
-        x1 = offset_x + x1*scale;
-        y1 = offset_y + y1*scale;
-        x2 = offset_x + x2*scale;
-        y2 = offset_y + y2*scale;
-        SDL_RenderDrawLineF(&renderer, x1,y1,x2,y2);
+        x1 = atom1->x + (params.atom_radius/2) * nx;
+        y1 = atom1->y + (params.atom_radius/2) * ny;
+        x2 = atom1->x + dx - (params.atom_radius/2) * nx;
+        y2 = atom1->y + dy - (params.atom_radius/2) * ny;
     };
 };
-
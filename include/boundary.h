@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cmath>
+
+// Boundary conditions at the edges of the world.
+// The simulation step is instantiated for each policy, so the hot loops
+// don't branch on the boundary mode at runtime.
+enum class Boundary {
+    reflect,    // atoms bounce off the walls
+    periodic,   // toroidal world: leaving at one side means entering at the other 
+    open,       // atoms touching the edge of the world are absorbed (removed)
+};
+
+// shortest displacement along an axis of the given size
+template<Boundary B>
+inline float boundary_delta(float d, float size) {
+    if constexpr (B == Boundary::periodic) {
+        if (d > size * 0.5f) d -= size;
+        else if (d < -size * 0.5f) d += size;
+    }
+    return d;
+}
+
+// wrap a coordinate into [0, size)
+inline float wrap_coordinate(float x, float size) {
+    x -= std::floor(x / size) * size;
+    return (x < size) ? x : 0;      // x/size may round up
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "world.h"
+
+// Compares a reference world and a candidate world that are stepped in lockstep, to find the
+// first step at which they differ, and the atoms that differ. For checking that a change to
+// the simulation, e.g. a new memory layout, threading or SIMD, doesn't change its outcome.
+//
+// With tolerance 0, the worlds must be identical. This is for paths that promise determinism,
+// such as loading a snapshot. The state hashes are compared first, so a step only costs two
+// hashes until the worlds diverge. With a tolerance, positions and velocities may differ by that
+// much. This is for paths that change the order of floating point operations or random numbers.
+// Types, states and bonds must always be the same.
+class DifferentialChecker
+{
+public:
+
+    struct Divergence {
+        int step = 0;
+        int num_atoms = 0;              // atoms that differ
+        std::vector<int> atom_ids;      // the first max_reported of them
+        std::vector<std::string> details;
+    };
+
+    // Call after every step of both worlds; nothing if they are the same.
+    std::optional<Divergence> compare(const World& reference, const World& candidate) {
+        if (tolerance == 0 && reference.state_hash() == candidate.state_hash()) return std::nullopt;
+
+        Divergence divergence;
+        divergence.step = reference.step_count;
+        std::set<int> ids;      // of atoms that differ
+        auto report = [&](int id, const std::string& detail) {
+            if (ids.insert(id).second && divergence.details.size() < max_reported) {
+                divergence.atom_ids.push_back(id);
+                divergence.details.push_back("atom " + std::to_string(id) + ": " + detail);
+            }
+        };
+
+        std::unordered_map<int,const Atom*> candidate_atoms;
+        for (auto& atom: candidate.atoms) {
+            candidate_atoms[atom->id] = atom.get();
+        }
+        for (auto& atom: reference.atoms) {
+            auto it = candidate_atoms.find(atom->id);
+            if (it == candidate_atoms.end()) {
+                report(atom->id, "missing");
+                continue;
+            }
+            const Atom& other = *it->second;
+            candidate_atoms.erase(it);
+            if (atom->key != other.key) {
+                report(atom->id, "is " + key_name(other.key) + ", expected " + key_name(atom->key));
+            }
+            else if (differ(atom->x, other.x) || differ(atom->y, other.y)) {
+                report(atom->id, position_text(other.x, other.y) + ", expected " + position_text(atom->x, atom->y));
+            }
+            else if (differ(atom->vx, other.vx) || differ(atom->vy, other.vy)) {
+                report(atom->id, "velocity " + position_text(other.vx, other.vy) + ", expected " + position_text(atom->vx, atom->vy));
+            }
+        }
+        for (auto& [id, atom]: candidate_atoms) {
+            report(id, "unexpected");
+        }
+
+        auto reference_bonds = bond_set(reference);
+        auto candidate_bonds = bond_set(candidate);
+        for (auto& [id1, id2]: reference_bonds) {
+            if (!candidate_bonds.contains({id1, id2})) report(id1, "missing bond with " + std::to_string(id2));
+        }
+        for (auto& [id1, id2]: candidate_bonds) {
+            if (!reference_bonds.contains({id1, id2})) report(id1, "unexpected bond with " + std::to_string(id2));
+        }
+
+        divergence.num_atoms = ids.size();
+        if (ids.empty()) return std::nullopt;
+        return divergence;
+    }
+
+    float tolerance = 0;        // 0: exact
+    int max_reported = 10;
+
+private:
+
+    bool differ(float a, float b) const {
+        if (tolerance == 0) return std::bit_cast<uint32_t>(a) != std::bit_cast<uint32_t>(b);
+        return !(std::abs(a - b) <= tolerance);
+    }
+
+    static std::string position_text(float x, float y) {
+        char text[64];
+        snprintf(text, sizeof(text), "(%.9g, %.9g)", x, y);
+        return text;
+    }
+
+    static std::set<std::pair<int,int>> bond_set(const World& world) {
+        std::set<std::pair<int,int>> set;
+        for (auto& bond: world.bonds) {
+            set.insert(std::minmax(bond->atom1->id, bond->atom2->id));
+        }
+        return set;
+    }
+};
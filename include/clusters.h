@@ -0,0 +1,211 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+#include "atom.h"
+
+// Connected components of the bond graph, i.e. molecules, maintained incrementally.
+// A new bond between two clusters relabels the atoms of the smaller one.
+// A broken bond starts a search from both of its atoms at once; if one search runs
+// out before they meet, the atoms it found are split off into a new cluster.
+// Both cost about the size of the smaller part, not a pass over all atoms.
+class ClusterTracker
+{
+public:
+
+    struct Cluster {
+        int size = 0;                   // 0 if the id is free
+    };
+
+    void clear() {
+        clusters.clear();
+        free_ids.clear();
+        size_histogram.assign(2, 0);
+        num_clusters = 0;
+    }
+
+    // an atom without bonds
+    void add_atom(Atom& atom) {
+        atom.neighbours.clear();
+        atom.cluster = new_cluster();
+        add_to_cluster(atom, atom.cluster);
+    }
+
+    // an atom without bonds
+    void remove_atom(Atom& atom) {
+        remove_from_cluster(atom);
+        atom.cluster = -1;
+    }
+
+    void add_bond(Atom& atom1, Atom& atom2) {
+        if (atom1.cluster != atom2.cluster) {
+            // relabel the smaller cluster; done before linking, so the search stays in it
+            Atom& small = (clusters[atom1.cluster].size < clusters[atom2.cluster].size) ? atom1 : atom2;
+            Atom& large = (&small == &atom1) ? atom2 : atom1;
+            search(small);
+            for (Atom* atom: found[0]) {
+                remove_from_cluster(*atom);
+                add_to_cluster(*atom, large.cluster);
+            }
+        }
+        atom1.neighbours.push_back(&atom2);
+        atom2.neighbours.push_back(&atom1);
+    }
+
+    void remove_bond(Atom& atom1, Atom& atom2) {
+        unlink(atom1, &atom2);
+        unlink(atom2, &atom1);
+        if (atom1.neighbours.empty() || atom2.neighbours.empty()) {
+            // one of them is on its own now
+            Atom& single = atom1.neighbours.empty() ? atom1 : atom2;
+            if (clusters[single.cluster].size > 1) split(std::vector<Atom*>{&single});
+            return;
+        }
+        // search from both sides, one atom at a time, until they meet or one runs out
+        mark += 2;
+        int side = 0;
+        found[0].assign(1, &atom1);
+        found[1].assign(1, &atom2);
+        atom1.search_mark = mark;
+        atom2.search_mark = mark + 1;
+        size_t next[2] = {0, 0};
+        while (true) {
+            if (next[side] == found[side].size()) {
+                split(found[side]);
+                return;
+            }
+            Atom* atom = found[side][next[side]++];
+            for (Atom* neighbour: atom->neighbours) {
+                if (neighbour->search_mark == mark + (1-side)) return;     // still connected
+                if (neighbour->search_mark == mark + side) continue;
+                neighbour->search_mark = mark + side;
+                found[side].push_back(neighbour);
+            }
+            side = 1 - side;
+        }
+    }
+
+    int largest() const {
+        for (int size=size_histogram.size()-1;size>0;--size) {
+            if (size_histogram[size] > 0) return size;
+        }
+        return 0;
+    }
+
+    // composition of a cluster from its atoms per type, e.g. "a2b1e3"
+    static std::string signature(const std::vector<int>& type_count) {
+        std::string text;
+        for (int type=0;type<type_count.size();++type) {
+            if (type_count[type] > 0) text += type_name(type) + std::to_string(type_count[type]);
+        }
+        return text;
+    }
+
+    // Number of clusters per signature, for clusters of at least min_size atoms; most common first.
+    // The atoms per type are counted here, rather than kept per cluster, as there may be many types.
+    std::vector<std::pair<std::string,int>> signature_counts(const std::vector<std::shared_ptr<Atom>>& atoms, int min_size = 2) const {
+        std::unordered_map<int,std::vector<int>> type_counts;      // per cluster
+        for (auto& atom: atoms) {
+            if (atom->cluster < 0 || clusters[atom->cluster].size < min_size) continue;
+            auto& type_count = type_counts[atom->cluster];
+            if (type_count.size() <= atom->type()) type_count.resize(atom->type() + 1, 0);
+            type_count[atom->type()]++;
+        }
+        std::unordered_map<std::string,int> counts;
+        for (auto& [id, type_count]: type_counts) {
+            counts[signature(type_count)]++;
+        }
+        std::vector<std::pair<std::string,int>> sorted(counts.begin(), counts.end());
+        std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        return sorted;
+    }
+
+    // memory used, without the neighbour lists of the atoms
+    size_t bytes() const {
+        return clusters.capacity() * sizeof(Cluster) + size_histogram.capacity() * sizeof(int) + free_ids.capacity() * sizeof(int);
+    }
+
+    // variables
+
+    std::vector<Cluster> clusters;      // indexed by Atom::cluster
+    std::vector<int> size_histogram = {0, 0};    // number of clusters of each size
+    int num_clusters = 0;
+
+private:
+
+    int new_cluster() {
+        num_clusters++;
+        if (!free_ids.empty()) {
+            int id = free_ids.back();
+            free_ids.pop_back();
+            return id;
+        }
+        clusters.emplace_back();
+        return clusters.size()-1;
+    }
+
+    void free_cluster(int id) {
+        clusters[id] = Cluster();
+        free_ids.push_back(id);
+        num_clusters--;
+    }
+
+    void add_to_cluster(Atom& atom, int id) {
+        Cluster& cluster = clusters[id];
+        if (cluster.size > 0) size_histogram[cluster.size]--;
+        cluster.size++;
+        if (cluster.size >= size_histogram.size()) size_histogram.resize(cluster.size + 1, 0);
+        size_histogram[cluster.size]++;
+        atom.cluster = id;
+    }
+
+    void remove_from_cluster(Atom& atom) {
+        Cluster& cluster = clusters[atom.cluster];
+        size_histogram[cluster.size]--;
+        cluster.size--;
+        if (cluster.size > 0) size_histogram[cluster.size]++;
+        else free_cluster(atom.cluster);     // the last atom left
+    }
+
+    // move the given atoms, a part of their cluster, to a new cluster
+    void split(const std::vector<Atom*>& atoms) {
+        int id = new_cluster();
+        for (Atom* atom: atoms) {
+            remove_from_cluster(*atom);
+            add_to_cluster(*atom, id);
+        }
+    }
+
+    // breadth-first search of the atoms connected to start, into found[0]
+    void search(Atom& start) {
+        mark += 2;
+        found[0].assign(1, &start);
+        start.search_mark = mark;
+        for (size_t i=0;i<found[0].size();++i) {
+            for (Atom* neighbour: found[0][i]->neighbours) {
+                if (neighbour->search_mark == mark) continue;
+                neighbour->search_mark = mark;
+                found[0].push_back(neighbour);
+            }
+        }
+    }
+
+    static void unlink(Atom& atom, Atom* neighbour) {
+        auto& list = atom.neighbours;
+        auto it = std::find(list.begin(), list.end(), neighbour);
+        if (it == list.end()) return;
+        *it = list.back();
+        list.pop_back();
+    }
+
+    std::vector<int> free_ids;
+    std::array<std::vector<Atom*>,2> found;     // search results, reused
+    unsigned mark = 0;                          // search marks are mark (side 0) and mark+1 (side 1)
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "world.h"
+
+// IEEE half precision, rounded to nearest; enough for velocities, which are a few units at most
+inline uint16_t half_from_float(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31) return sign | 0x7c00;           // too large, or inf or nan: inf
+    if (exponent <= 0) {
+        if (exponent < -10) return sign;                // too small: 0
+        // subnormal
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++;
+        return sign | half;
+    }
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) half++;                      // may carry into the exponent, which is right
+    return half;
+}
+
+inline float float_from_half(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    if (exponent == 0) {
+        // zero or subnormal
+        float value = std::ldexp((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+    if (exponent == 31) return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+    return std::bit_cast<float>(sign | ((uint32_t)(exponent - 15 + 127) << 23) | (mantissa << 13));
+}
+
+// A world in about 14 bytes per atom and 8 per bond, instead of the hundreds of a Snapshot
+// and the live atoms. The atoms are stored by spacemap cell, with:
+//  - the position as a 16-bit fixed point offset from the corner of the cell, in 1/16384 of a
+//    cell, from one cell before to three cells after the corner (border cells hold atoms on and
+//    beyond the edge),
+//  - the velocity in half precision,
+//  - the type and state as their 16-bit key,
+//  - the id,
+// and the bonds as pairs of 32-bit atom indices.
+//
+// Unlike a Snapshot this is lossy: positions are rounded to 1/8192 of an atom radius, velocities to
+// 3 significant digits, and decode() wakes all atoms and numbers the molecules anew. So the world
+// goes on close to, but not exactly as, it would have. See Timeline::compact.
+struct CompactState
+{
+    static constexpr int fraction = 16384;      // fixed point units per cell
+
+    int step_count = 0;
+    double time = 0;
+    int next_atom_id = 0;
+    uint64_t random_state = 0;
+    PhysicsParameters params;
+    PhysicsParameters last_params;
+    std::vector<Rule> rules;
+    std::vector<Region> regions;
+
+    std::vector<uint32_t> cell_start;   // atoms of cell i are cell_start[i] up to cell_start[i+1]
+    std::vector<uint16_t> x;
+    std::vector<uint16_t> y;
+    std::vector<uint16_t> vx;
+    std::vector<uint16_t> vy;
+    std::vector<AtomKey> key;
+    std::vector<uint32_t> id;
+    std::vector<uint32_t> bonds;        // atom indices, two per bond
+
+    void encode(const World& world) {
+        step_count = world.step_count;
+        time = world.time;
+        next_atom_id = world.next_atom_id;
+        random_state = world.random.state;
+        params = world.params;
+        last_params = world.last_params;
+        rules.clear();
+        for (auto& rule: world.rules) {
+            rules.push_back(*rule);
+        }
+        regions = world.regions;
+
+        const SpaceMap& spacemap = *world.spacemap;
+        cell_start.assign(spacemap.cells.size() + 1, 0);
+        x.clear();
+        y.clear();
+        vx.clear();
+        vy.clear();
+        key.clear();
+        id.clear();
+        std::vector<int> index_of(world.atoms.size(), -1);      // compact index of each atom
+        for (int cell=0;cell<spacemap.cells.size();++cell) {
+            cell_start[cell] = id.size();
+            float corner_x = (cell % spacemap.nx) * spacemap.xstep;
+            float corner_y = (cell / spacemap.nx) * spacemap.ystep;
+            for (auto& atom: spacemap.cells[cell]) {
+                index_of[atom->index] = id.size();
+                x.push_back(to_fixed(atom->x - corner_x, spacemap.xstep));
+                y.push_back(to_fixed(atom->y - corner_y, spacemap.ystep));
+                vx.push_back(half_from_float(atom->vx));
+                vy.push_back(half_from_float(atom->vy));
+                key.push_back(atom->key);
+                id.push_back(atom->id);
+            }
+        }
+        cell_start.back() = id.size();
+
+        bonds.clear();
+        for (auto& bond: world.bonds) {
+            bonds.push_back(index_of[bond->atom1->index]);
+            bonds.push_back(index_of[bond->atom2->index]);
+        }
+    }
+
+    void decode(World& world) const {
+        world.step_count = step_count;
+        world.time = time;
+        world.random.state = random_state;
+        world.params = params;
+        world.last_params = last_params;
+        world.rules.clear();
+        for (auto& rule: rules) {
+            world.rules.push_back(std::make_unique<Rule>(rule));
+        }
+        world.regions = regions;
+        world.clear();
+
+        const SpaceMap& spacemap = *world.spacemap;
+        std::vector<std::shared_ptr<Atom>> atoms;
+        atoms.reserve(id.size());
+        for (int cell=0;cell+1<cell_start.size();++cell) {
+            float corner_x = (cell % spacemap.nx) * spacemap.xstep;
+            float corner_y = (cell / spacemap.nx) * spacemap.ystep;
+            for (uint32_t i=cell_start[cell];i<cell_start[cell+1];++i) {
+                auto atom = world.add_atom(corner_x + from_fixed(x[i], spacemap.xstep),
+                                           corner_y + from_fixed(y[i], spacemap.ystep), key_type(key[i]), key_state(key[i]));
+                atom->id = id[i];
+                atom->vx = float_from_half(vx[i]);
+                atom->vy = float_from_half(vy[i]);
+                atoms.push_back(atom);
+            }
+        }
+        world.next_atom_id = next_atom_id;
+        for (int i=0;i<bonds.size();i+=2) {
+            world.add_bond(atoms[bonds[i]], atoms[bonds[i+1]]);
+        }
+    }
+
+    size_t bytes() const {
+        return sizeof(CompactState) + cell_start.size() * sizeof(uint32_t)
+            + id.size() * (4 * sizeof(uint16_t) + sizeof(AtomKey) + sizeof(uint32_t))
+            + bonds.size() * sizeof(uint32_t)
+            + rules.size() * sizeof(Rule) + regions.size() * sizeof(Region);
+    }
+
+    // an offset from the corner of a cell of size step, and back
+    static uint16_t to_fixed(float offset, float step) {
+        long value = std::lround(offset / step * fraction) + fraction;
+        return std::clamp(value, 0L, 65535L);
+    }
+
+    static float from_fixed(uint16_t value, float step) {
+        return (value - fraction) * step / fraction;
+    }
+};
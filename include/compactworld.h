@@ -0,0 +1,511 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "compact.h"
+
+// A world that lives in a CompactState, for runs with more atoms than fit in memory as a World.
+// Between steps there are only the compact arrays (see CompactState); a step decodes the
+// positions and velocities into float scratch arrays, makes a decomposable step with them (see
+// World::decomposable) and rounds the atoms back into their cells. So a run is close to, but not
+// the same as, the decomposable run of a World: after every step, positions are rounded to
+// 1/8192 of an atom radius and velocities to half precision.
+// Not supported: sleeping, sources and sinks, stochastic rules and the Verlet integrator. Nothing
+// draws a compact world; it is run by organicsoup --headless --compact.
+class CompactWorld
+{
+public:
+
+    // the atoms and bonds that world.restart() would make, placed straight into the compact
+    // arrays, with the parameters, rules and random numbers of world
+    explicit CompactWorld(World& world) {
+        if (world.sleeping_enabled) throw std::runtime_error("the compact world doesn't support sleeping");
+        if (!world.regions.empty()) throw std::runtime_error("the compact world doesn't support sources and sinks");
+        if (world.stochastic_rules) throw std::runtime_error("the compact world doesn't support stochastic rules");
+        if (world.params.integrator == Integrator::verlet) throw std::runtime_error("the compact world doesn't support the Verlet integrator");
+        state.params = world.params;
+        state.last_params = world.params;
+        for (auto& rule: world.rules) {
+            rules.push_back(std::make_unique<Rule>(*rule));
+        }
+        const PhysicsParameters& params = state.params;
+        xstep = ystep = params.atom_radius*2;       // the cells of World::spacemap
+        nx = static_cast<int>(params.space_width / xstep);
+        ny = static_cast<int>(params.space_height / ystep);
+
+        std::vector<Seeder::Placement> placements;
+        std::vector<std::pair<int,int>> placed_bonds;
+        if (world.start_layout == StartLayout::random && world.start_molecules.empty()) {
+            for (int type=0;type<world.start_atoms.size();++type) {
+                for (int i=0;i<world.start_atoms[type];++i) {
+                    float x = world.random.randf(0, params.space_width);
+                    float y = world.random.randf(0, params.space_height);
+                    placements.push_back({x, y, atom_key(type, 0)});
+                }
+            }
+        }
+        else {
+            Seeder seeder;
+            seeder.seed(params, world.start_atoms, world.start_molecules, world.random, world.start_threads);
+            if (seeder.missing_atoms > 0 || seeder.missing_molecules > 0) {
+                std::cerr << "no room for " << seeder.missing_atoms << " atoms and " << seeder.missing_molecules << " molecules\n";
+            }
+            placements = std::move(seeder.atoms);
+            placed_bonds = std::move(seeder.bonds);
+        }
+        state.random_state = world.random.state;
+
+        // ids in the order of placement, as World::restart() gives them
+        int n = placements.size();
+        px.resize(n);
+        py.resize(n);
+        vx.assign(n, 0);
+        vy.assign(n, 0);
+        state.key.resize(n);
+        state.id.resize(n);
+        for (int i=0;i<n;++i) {
+            px[i] = placements[i].x;
+            py[i] = placements[i].y;
+            state.key[i] = placements[i].key;
+            state.id[i] = i;
+        }
+        state.next_atom_id = n;
+        for (auto [i, j]: placed_bonds) {
+            state.bonds.push_back(i);
+            state.bonds.push_back(j);
+        }
+        removed.assign(n, 0);
+        pack();
+    }
+
+    void update() {
+        switch (state.params.boundary) {
+            case Boundary::reflect: step<Boundary::reflect>(); break;
+            case Boundary::periodic: step<Boundary::periodic>(); break;
+            case Boundary::open: step<Boundary::open>(); break;
+        }
+    }
+
+    int num_atoms() const { return state.id.size(); }
+    int num_bonds() const { return state.bonds.size() / 2; }
+
+    // the scratch arrays of a step, kept for the next one
+    size_t scratch_bytes() const {
+        return (px.capacity() + py.capacity() + vx.capacity() + vy.capacity()
+                + dvx.capacity() + dvy.capacity() + correction_x.capacity() + correction_y.capacity()) * sizeof(float)
+            + correction_n.capacity() * sizeof(uint16_t) + removed.capacity()
+            + (new_index.capacity() + cursor.capacity() + adjacency_start.capacity()) * sizeof(uint32_t)
+            + adjacency.capacity() * sizeof(Adjacent) + best_candidate.capacity() * sizeof(int)
+            + candidates.capacity() * sizeof(Candidate)
+            + packed_key.capacity() * sizeof(AtomKey) + packed_id.capacity() * sizeof(uint32_t);
+    }
+
+    // a hash of the atoms and bonds, to compare runs
+    uint64_t state_hash() const {
+        uint64_t hash = counter_hash(state.step_count, num_atoms());
+        for (int i=0;i<num_atoms();++i) {
+            hash = counter_hash(hash, (uint64_t)state.id[i] << 16 | state.key[i]);
+            hash = counter_hash(hash, (uint64_t)state.x[i] | (uint64_t)state.y[i] << 16 | (uint64_t)state.vx[i] << 32 | (uint64_t)state.vy[i] << 48);
+        }
+        for (uint32_t atom: state.bonds) {
+            hash = counter_hash(hash, atom);
+        }
+        return hash;
+    }
+
+    // into a World, e.g. to look at it or go on with it there
+    void decode(World& world) {
+        state.rules.clear();
+        for (auto& rule: rules) {
+            state.rules.push_back(*rule);
+        }
+        state.decode(world);
+    }
+
+    CompactState state;
+    std::vector<std::unique_ptr<Rule>> rules;       // state.rules is only filled for decode()
+
+private:
+
+    struct Adjacent {
+        uint32_t atom;
+        uint32_t bond;          // index of the pair in state.bonds
+    };
+
+    struct Candidate {
+        uint32_t atom1;         // as the rule has them
+        uint32_t atom2;
+        int rule;
+        uint64_t priority;
+    };
+
+    static constexpr uint32_t removed_bond = UINT32_MAX;
+    static constexpr float max_half = 65504;        // the largest finite half
+
+    template<Boundary B>
+    void step() {
+        const PhysicsParameters& params = state.params;
+        unpack();
+        int n = num_atoms();
+        uint64_t step_key = counter_hash(state.random_state, state.step_count);
+
+        // the reactions, as World::simultaneous_reactions() decides them
+        build_adjacency();
+        react<B>(step_key ^ 0x5bd1e9955bd1e995ULL);
+
+        // bonds stretched too far break, and their atoms go back to state 0
+        for (int b=0;b<num_bonds();++b) {
+            uint32_t atom1 = state.bonds[2*b];
+            uint32_t atom2 = state.bonds[2*b+1];
+            if (atom1 == removed_bond) continue;
+            float dx = boundary_delta<B>(px[atom2] - px[atom1], params.space_width);
+            float dy = boundary_delta<B>(py[atom2] - py[atom1], params.space_height);
+            if (sqrt(dx*dx + dy*dy) > params.bonding_end_distance) {
+                state.key[atom1] = atom_key(key_type(state.key[atom1]), 0);
+                state.key[atom2] = atom_key(key_type(state.key[atom2]), 0);
+                state.bonds[2*b] = state.bonds[2*b+1] = removed_bond;
+            }
+        }
+
+        // bond forces, by atom in the order of the ids of the partners, as World::bond_forces_by_atom()
+        build_adjacency();
+        for (int i=0;i<n;++i) {
+            auto first = adjacency.begin() + adjacency_start[i];
+            auto last = adjacency.begin() + adjacency_start[i+1];
+            std::sort(first, last, [&](const Adjacent& a, const Adjacent& b) { return state.id[a.atom] < state.id[b.atom]; });
+            for (auto it=first;it!=last;++it) {
+                // atoms on the same spot pull in no direction
+                if (px[i] == px[it->atom] && py[i] == py[it->atom]) continue;
+                float fx, fy;
+                Bond::force<B>(params, px[i], py[i], px[it->atom], py[it->atom], fx, fy);
+                vx[i] += fx * params.dt;
+                vy[i] += fy * params.dt;
+            }
+        }
+
+        // collisions, all with the velocities from before any of them
+        dvx.assign(n, 0);
+        dvy.assign(n, 0);
+        correction_x.assign(n, 0);
+        correction_y.assign(n, 0);
+        correction_n.assign(n, 0);
+        for_each_pair<B>(params.atom_radius*2, [&](uint32_t i, uint32_t j) {
+            float change_x, change_y, correct_x, correct_y;
+            if (!Atom::collision<B>(params, px[i], py[i], vx[i], vy[i], px[j], py[j], vx[j], vy[j], change_x, change_y, correct_x, correct_y)) return;
+            dvx[i] -= change_x;
+            dvy[i] -= change_y;
+            correction_x[i] -= correct_x;
+            correction_y[i] -= correct_y;
+            correction_n[i]++;
+            dvx[j] += change_x;
+            dvy[j] += change_y;
+            correction_x[j] += correct_x;
+            correction_y[j] += correct_y;
+            correction_n[j]++;
+        });
+
+        // move, with the random numbers of World::step() for decomposable steps
+        float damping = 1 - std::pow(1 - params.friction, params.dt);     // World::step_damping()
+        float kick = params.temp * std::sqrt(params.dt);                // World::step_kick()
+        for (int i=0;i<n;++i) {
+            Atom atom(params, px[i], py[i], key_type(state.key[i]), key_state(state.key[i]));
+            atom.vx = vx[i] + dvx[i];
+            atom.vy = vy[i] + dvy[i];
+            atom.correction_x = correction_x[i];
+            atom.correction_y = correction_y[i];
+            atom.correction_n = correction_n[i];
+            Random atom_random(counter_hash(step_key, state.id[i]));
+            atom.update<B>(atom_random, params.dt, damping, kick);
+            px[i] = atom.x;
+            py[i] = atom.y;
+            vx[i] = atom.vx;
+            vy[i] = atom.vy;
+            if constexpr (B == Boundary::open) {
+                if (atom.off_world()) removed[i] = 1;
+            }
+        }
+
+        // the compact positions reach only a cell beyond the edges, so atoms that overshoot the
+        // edges of a reflecting world, as in an exploding one, are reflected back into it; not
+        // clamped to the edges, as atoms on the same spot would never come apart
+        if constexpr (B == Boundary::reflect) {
+            for (int i=0;i<n;++i) {
+                px[i] = fold(px[i], params.space_width);
+                py[i] = fold(py[i], params.space_height);
+            }
+        }
+        pack();
+        state.step_count++;
+        state.time += params.dt;
+    }
+
+    // Each pair of candidates for a reaction gets a priority, and reacts if it has the highest of
+    // the candidates of both its atoms; see World::simultaneous_reactions().
+    template<Boundary B>
+    void react(uint64_t step_key) {
+        const PhysicsParameters& params = state.params;
+        rule_table.update(rules);
+        candidates.clear();
+        best_candidate.assign(num_atoms(), -1);
+        auto rank = [&](const Candidate& candidate) {
+            uint32_t id1 = state.id[candidate.atom1];
+            uint32_t id2 = state.id[candidate.atom2];
+            return std::tuple(candidate.priority, std::min(id1, id2), std::max(id1, id2));
+        };
+        float pair_distance = fmax(params.bonding_start_distance, params.atom_radius*2);
+        for_each_pair<B>(pair_distance, [&](uint32_t i, uint32_t j) {
+            AtomKey key1 = state.key[i];
+            AtomKey key2 = state.key[j];
+            uint32_t low = std::min(state.id[i], state.id[j]);
+            uint32_t high = std::max(state.id[i], state.id[j]);
+            uint64_t pair_key = counter_hash(counter_hash(step_key, low), high);
+            bool bonded = bond_between(i, j) >= 0;
+            for (int r=-1;(r = rule_table.next(key1, key2, r)) >= 0;) {
+                Rule& rule = *rules[r];
+                bool swapped = false;
+                bool matched = rule.match(key1, key2, bonded);
+                if (!matched) {
+                    matched = rule.match(key2, key1, bonded);
+                    swapped = matched;
+                }
+                if (!matched) continue;
+                if (rule.rate < 1 && hash_unit(counter_hash(pair_key, r)) >= rule.rate) continue;
+                int candidate = candidates.size();
+                candidates.push_back({swapped ? j : i, swapped ? i : j, r, pair_key});
+                for (uint32_t atom: {i, j}) {
+                    int& best = best_candidate[atom];
+                    if (best < 0 || rank(candidates[best]) < rank(candidates[candidate])) {
+                        best = candidate;
+                    }
+                }
+                break;
+            }
+        });
+        // an atom reacts at most once, so the bonds it has are those it had at the start of the step
+        for (int c=0;c<(int)candidates.size();++c) {
+            auto& candidate = candidates[c];
+            uint32_t atom1 = candidate.atom1;
+            uint32_t atom2 = candidate.atom2;
+            if (best_candidate[atom1] != c || best_candidate[atom2] != c) continue;
+            Rule& rule = *rules[candidate.rule];
+            state.key[atom1] = atom_key(key_type(state.key[atom1]), rule.after_state1);
+            state.key[atom2] = atom_key(key_type(state.key[atom2]), rule.after_state2);
+            int bond = bond_between(atom1, atom2);
+            bool blocked = false;
+            if (rule.after_bonded && bond < 0) {
+                blocked = num_bonds_of(atom1) >= params.max_bonds_per_atom || num_bonds_of(atom2) >= params.max_bonds_per_atom;
+                if (!blocked) {
+                    state.bonds.push_back(atom1);
+                    state.bonds.push_back(atom2);
+                }
+            }
+            else if (!rule.after_bonded && bond >= 0) {
+                state.bonds[2*bond] = state.bonds[2*bond+1] = removed_bond;
+            }
+            rule.stats.hits++;
+            if (blocked) rule.stats.blocked++;
+        }
+    }
+
+    // f(i, j) for the atoms closer than distance, each pair once, with i < j
+    template<Boundary B, typename F>
+    void for_each_pair(float distance, F f) const {
+        const PhysicsParameters& params = state.params;
+        float distance2 = distance * distance;
+        int rx = static_cast<int>(distance / xstep)+1;
+        int ry = static_cast<int>(distance / ystep)+1;
+        // in a periodic world the range wraps, but no cell may be visited twice
+        int span_x = 2*rx+1;
+        int span_y = 2*ry+1;
+        if constexpr (B == Boundary::periodic) {
+            span_x = std::min(span_x, nx);
+            span_y = std::min(span_y, ny);
+        }
+        for (int iy1=0;iy1<ny;++iy1) {
+            for (int ix1=0;ix1<nx;++ix1) {
+                int cell1 = iy1*nx + ix1;
+                uint32_t begin1 = state.cell_start[cell1];
+                uint32_t end1 = state.cell_start[cell1+1];
+                if (begin1 == end1) continue;
+                for (int iy2=iy1-ry;iy2<iy1-ry+span_y;++iy2) {
+                    int wy2 = iy2;
+                    if constexpr (B == Boundary::periodic) wy2 = ((iy2 % ny) + ny) % ny;
+                    else if (iy2 < 0 || iy2 >= ny) continue;
+                    for (int ix2=ix1-rx;ix2<ix1-rx+span_x;++ix2) {
+                        int wx2 = ix2;
+                        if constexpr (B == Boundary::periodic) wx2 = ((ix2 % nx) + nx) % nx;
+                        else if (ix2 < 0 || ix2 >= nx) continue;
+                        int cell2 = wy2*nx + wx2;
+                        uint32_t begin2 = state.cell_start[cell2];
+                        uint32_t end2 = state.cell_start[cell2+1];
+                        for (uint32_t i=begin1;i<end1;++i) {
+                            for (uint32_t j=std::max(begin2, i+1);j<end2;++j) {
+                                float dx = boundary_delta<B>(px[j] - px[i], params.space_width);
+                                float dy = boundary_delta<B>(py[j] - py[i], params.space_height);
+                                if (dx*dx + dy*dy < distance2) f(i, j);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // a coordinate reflected at 0 and size until it is between them
+    static float fold(float coordinate, float size) {
+        if (coordinate >= 0 && coordinate <= size) return coordinate;
+        float folded = std::fmod(coordinate, 2*size);
+        if (folded < 0) folded += 2*size;
+        return (folded > size) ? 2*size - folded : folded;
+    }
+
+    // the bonds of each atom, from state.bonds
+    void build_adjacency() {
+        int n = num_atoms();
+        adjacency_start.assign(n+1, 0);
+        for (int b=0;b<num_bonds();++b) {
+            if (state.bonds[2*b] == removed_bond) continue;
+            adjacency_start[state.bonds[2*b]+1]++;
+            adjacency_start[state.bonds[2*b+1]+1]++;
+        }
+        for (int i=0;i<n;++i) {
+            adjacency_start[i+1] += adjacency_start[i];
+        }
+        adjacency.resize(adjacency_start[n]);
+        cursor.assign(adjacency_start.begin(), adjacency_start.end()-1);
+        for (int b=0;b<num_bonds();++b) {
+            uint32_t atom1 = state.bonds[2*b];
+            uint32_t atom2 = state.bonds[2*b+1];
+            if (atom1 == removed_bond) continue;
+            adjacency[cursor[atom1]++] = {atom2, (uint32_t)b};
+            adjacency[cursor[atom2]++] = {atom1, (uint32_t)b};
+        }
+    }
+
+    // the index of the bond between two atoms in state.bonds, or -1; as of build_adjacency()
+    int bond_between(uint32_t atom1, uint32_t atom2) const {
+        for (uint32_t k=adjacency_start[atom1];k<adjacency_start[atom1+1];++k) {
+            if (adjacency[k].atom == atom2) return adjacency[k].bond;
+        }
+        return -1;
+    }
+
+    int num_bonds_of(uint32_t atom) const {
+        return adjacency_start[atom+1] - adjacency_start[atom];
+    }
+
+    // the compact positions and velocities into the scratch arrays
+    void unpack() {
+        int n = num_atoms();
+        px.resize(n);
+        py.resize(n);
+        vx.resize(n);
+        vy.resize(n);
+        for (int cell=0;cell<nx*ny;++cell) {
+            float corner_x = (cell % nx) * xstep;
+            float corner_y = (cell / nx) * ystep;
+            for (uint32_t i=state.cell_start[cell];i<state.cell_start[cell+1];++i) {
+                px[i] = corner_x + CompactState::from_fixed(state.x[i], xstep);
+                py[i] = corner_y + CompactState::from_fixed(state.y[i], ystep);
+                vx[i] = float_from_half(state.vx[i]);
+                vy[i] = float_from_half(state.vy[i]);
+            }
+        }
+        removed.assign(n, 0);
+    }
+
+    // The atoms of the scratch arrays, whose keys and ids are in state in the same order, back
+    // into the compact arrays, sorted by the cell they are in now (a counting sort, in which the
+    // atoms of a cell keep their order). Removed atoms and bonds, and the bonds of removed atoms,
+    // are dropped.
+    void pack() {
+        int n = px.size();
+        int num_cells = nx * ny;
+        auto cell_of = [&](int i) {
+            int ix = std::clamp(static_cast<int>(px[i] / xstep), 0, nx-1);
+            int iy = std::clamp(static_cast<int>(py[i] / ystep), 0, ny-1);
+            return iy*nx + ix;
+        };
+        // new_index holds the cell of each atom until it is replaced by the new index
+        new_index.resize(n);
+        state.cell_start.assign(num_cells+1, 0);
+        for (int i=0;i<n;++i) {
+            if (removed[i]) continue;
+            new_index[i] = cell_of(i);
+            state.cell_start[new_index[i]+1]++;
+        }
+        for (int cell=0;cell<num_cells;++cell) {
+            state.cell_start[cell+1] += state.cell_start[cell];
+        }
+        int m = state.cell_start[num_cells];
+        cursor.assign(state.cell_start.begin(), state.cell_start.end()-1);
+        state.x.resize(m);
+        state.y.resize(m);
+        state.vx.resize(m);
+        state.vy.resize(m);
+        packed_key.resize(m);
+        packed_id.resize(m);
+        for (int i=0;i<n;++i) {
+            if (removed[i]) {
+                new_index[i] = removed_bond;
+                continue;
+            }
+            int cell = new_index[i];
+            uint32_t k = cursor[cell]++;
+            new_index[i] = k;
+            state.x[k] = CompactState::to_fixed(px[i] - (cell % nx) * xstep, xstep);
+            state.y[k] = CompactState::to_fixed(py[i] - (cell / nx) * ystep, ystep);
+            // an exploding world may go beyond half precision, but not to infinity
+            state.vx[k] = half_from_float(std::clamp(vx[i], -max_half, max_half));
+            state.vy[k] = half_from_float(std::clamp(vy[i], -max_half, max_half));
+            packed_key[k] = state.key[i];
+            packed_id[k] = state.id[i];
+        }
+        std::swap(state.key, packed_key);
+        std::swap(state.id, packed_id);
+
+        int num_kept = 0;
+        for (int b=0;b<num_bonds();++b) {
+            uint32_t atom1 = state.bonds[2*b];
+            uint32_t atom2 = state.bonds[2*b+1];
+            if (atom1 == removed_bond || new_index[atom1] == removed_bond || new_index[atom2] == removed_bond) continue;
+            state.bonds[2*num_kept] = new_index[atom1];
+            state.bonds[2*num_kept+1] = new_index[atom2];
+            num_kept++;
+        }
+        state.bonds.resize(2*num_kept);
+    }
+
+    float xstep = 1;
+    float ystep = 1;
+    int nx = 0;
+    int ny = 0;
+    RuleTable rule_table;
+
+    // scratch of a step
+    std::vector<float> px;
+    std::vector<float> py;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> dvx;                 // by collisions
+    std::vector<float> dvy;
+    std::vector<float> correction_x;
+    std::vector<float> correction_y;
+    std::vector<uint16_t> correction_n;
+    std::vector<uint8_t> removed;           // by an open boundary
+    std::vector<uint32_t> new_index;
+    std::vector<uint32_t> cursor;
+    std::vector<uint32_t> adjacency_start;  // bonds of atom i are adjacency_start[i] up to adjacency_start[i+1]
+    std::vector<Adjacent> adjacency;
+    std::vector<Candidate> candidates;
+    std::vector<int> best_candidate;
+    std::vector<AtomKey> packed_key;
+    std::vector<uint32_t> packed_id;
+};
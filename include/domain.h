@@ -0,0 +1,694 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "world.h"
+
+// Domain decomposition: the world is split into vertical strips along spacemap cell
+// boundaries, and each strip (domain) is simulated by its own World, possibly in its own process.
+//
+// A domain owns the atoms in its strip. Each step:
+//  1. halo: each domain sends the atoms within halo_width of a shared edge to that neighbour,
+//     and the atoms bonded to them or to that neighbour's atoms, with the ids of the atoms they
+//     are bonded to. There they are ghosts: copies that don't move, with the same bonds as their
+//     originals, as far as the other atoms are there too.
+//  2. step: each domain makes a decomposable step of its world (see World::decomposable). A
+//     pair of an owned atom and a ghost is seen by both domains, and both decide the same for
+//     it: an owned atom depends on the atoms within three interaction distances, e.g. on
+//     whether the ghost it collides with reacts with another one, which depends on the
+//     reactions that other one could have, and on all the bonds of these, however long.
+//     Ghosts further out may react differently than their originals; that is undone by the
+//     next halo, or by the migration that makes one of them owned.
+//  3. migration: atoms that moved into a neighbouring strip are sent there with their bonds,
+//     and the atoms they are bonded to as ghosts, and stay behind as ghosts.
+//
+// A bond between domains exists in both, between the owned atom and the ghost of the other.
+//
+// The result is the same as that of the whole world with decomposable steps, bit for bit, for
+// any number of domains, in one process or in several: see run_whole(). No strip may be narrower
+// than halo_width. An atom that crosses a whole strip in one step, or is bonded across more than
+// one, as after a dense random start, stops the run with an error.
+// Not supported in domains: periodic boundaries, sleeping, sources and sinks, stochastic rules
+// and the Verlet integrator, whose substeps would need the ghosts to move.
+
+// Messages between domains are sent by a Transport, e.g. over sockets, or within one process.
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+    virtual void send(int peer, const std::vector<char>& message) = 0;
+    virtual void receive(int peer, std::vector<char>& message) = 0;
+};
+
+// domains in one process; messages wait in mailboxes
+class LoopbackTransport: public Transport
+{
+public:
+    LoopbackTransport(int rank, std::map<std::pair<int,int>,std::vector<char>>& mailboxes)
+        :rank(rank), mailboxes(mailboxes) {}
+
+    void send(int peer, const std::vector<char>& message) override {
+        mailboxes[{rank, peer}] = message;
+    }
+
+    void receive(int peer, std::vector<char>& message) override {
+        message = std::move(mailboxes[{peer, rank}]);
+    }
+
+private:
+    int rank;
+    std::map<std::pair<int,int>,std::vector<char>>& mailboxes;
+};
+
+// domains in local processes, connected by Unix sockets; messages are length-prefixed
+class SocketTransport: public Transport
+{
+public:
+    void connect(int peer, int fd) {
+        fds[peer] = fd;
+    }
+
+    void send(int peer, const std::vector<char>& message) override {
+        uint64_t size = message.size();
+        write_all(fds.at(peer), &size, sizeof(size));
+        write_all(fds.at(peer), message.data(), size);
+    }
+
+    void receive(int peer, std::vector<char>& message) override {
+        uint64_t size = 0;
+        read_all(fds.at(peer), &size, sizeof(size));
+        message.resize(size);
+        read_all(fds.at(peer), message.data(), size);
+    }
+
+private:
+    static void write_all(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd, p, size);
+            if (n <= 0) throw std::runtime_error("domain socket write failed");
+            p += n;
+            size -= n;
+        }
+    }
+
+    static void read_all(int fd, void* data, size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t n = ::read(fd, p, size);
+            if (n <= 0) throw std::runtime_error("domain socket read failed");
+            p += n;
+            size -= n;
+        }
+    }
+
+    std::unordered_map<int,int> fds;
+};
+
+// an owned atom in the final result
+struct DomainAtom {
+    int id;
+    AtomKey key;
+    float x;
+    float y;
+};
+
+class Domain
+{
+public:
+
+    // setup prepares the world as for a single process run, e.g. parameters, rules and seed;
+    // every domain makes the same world and then keeps only the atoms in its strip
+    Domain(int rank, int num_domains, const std::function<void(World&)>& setup)
+        :rank(rank), num_domains(num_domains)
+    {
+        setup(world);
+        if (world.params.boundary == Boundary::periodic) throw std::runtime_error("domains don't support periodic boundaries");
+        if (world.sleeping_enabled) throw std::runtime_error("domains don't support sleeping");
+        if (!world.regions.empty()) throw std::runtime_error("domains don't support sources and sinks");
+        if (world.stochastic_rules) throw std::runtime_error("domains don't support stochastic rules");
+        if (world.params.integrator == Integrator::verlet) throw std::runtime_error("domains don't support the Verlet integrator");
+        world.decomposable = true;
+        world.restart();
+
+        // strips of whole spacemap cells
+        int nx = world.spacemap->nx;
+        for (int i=0;i<=num_domains;++i) {
+            edges.push_back((nx * i / num_domains) * world.spacemap->xstep);
+        }
+        edges.back() = INFINITY;
+        edges.front() = -INFINITY;
+        // three interaction distances and a diameter; bonds reach further, and their atoms are sent as well
+        float reach = std::max(std::max(world.params.bonding_start_distance, world.params.atom_radius*2), world.params.bonding_end_distance);
+        halo_width = 3 * reach + world.params.atom_radius*2;
+        for (int i=0;i<num_domains;++i) {
+            float width = (nx * (i+1) / num_domains - nx * i / num_domains) * world.spacemap->xstep;
+            if (width < halo_width) throw std::runtime_error("too many domains: the strips are narrower than the halo");
+        }
+
+        // the atoms of the neighbours near the edges are ghosts from the start, so that the bonds
+        // across are kept, and so are the atoms bonded to them or to the atoms of this strip
+        std::vector<Atom*> kept;
+        for (auto& atom: world.atoms) {
+            int atom_owner = owner(atom->x);
+            bool near = (atom_owner == rank-1 && atom->x >= edges[rank] - halo_width)
+                     || (atom_owner == rank+1 && atom->x <= edges[rank+1] + halo_width);
+            if (atom_owner == rank || near) kept.push_back(atom.get());
+            if (near) atom->ghost = true;
+        }
+        for (Atom* atom: kept) {
+            for (Atom* neighbour: atom->neighbours) {
+                int neighbour_owner = owner(neighbour->x);
+                if (neighbour_owner == rank-1 || neighbour_owner == rank+1) neighbour->ghost = true;
+            }
+        }
+        std::vector<int> others;
+        for (auto& atom: world.atoms) {
+            if (owner(atom->x) != rank && !atom->ghost) others.push_back(atom->index);
+        }
+        world.remove_atoms(others);
+
+        if (rank > 0) peers.push_back(rank-1);
+        if (rank < num_domains-1) peers.push_back(rank+1);
+    }
+
+    // the domain whose strip contains x
+    int owner(float x) const {
+        return std::upper_bound(edges.begin(), edges.end(), x) - edges.begin() - 1;
+    }
+
+    // one step; messages are made for all peers before any are read, so that the order of
+    // arrival doesn't matter
+    void step(Transport& transport) {
+        exchange(transport, &Domain::make_halo, &Domain::apply_halo);
+        world.update();
+        exchange(transport, &Domain::make_migration, &Domain::apply_migration);
+        finish_migration();
+    }
+
+    // phases, for running several domains in one process
+    using Make = void (Domain::*)(int peer, std::vector<char>& message);
+    using Apply = void (Domain::*)(int peer, const std::vector<char>& message);
+
+    void send_all(Transport& transport, Make make) {
+        for (int peer: peers) {
+            (this->*make)(peer, outbox[peer]);
+        }
+        for (int peer: peers) {
+            transport.send(peer, outbox[peer]);
+        }
+    }
+
+    void receive_all(Transport& transport, Apply apply) {
+        for (int peer: peers) {
+            transport.receive(peer, inbox);
+            (this->*apply)(peer, inbox);
+        }
+    }
+
+    void exchange(Transport& transport, Make make, Apply apply) {
+        for (int peer: peers) {
+            (this->*make)(peer, outbox[peer]);
+        }
+        // the lower rank sends first, so that blocking sockets don't deadlock
+        std::map<int,std::vector<char>> received;
+        for (int peer: peers) {
+            if (rank < peer) {
+                transport.send(peer, outbox[peer]);
+                transport.receive(peer, received[peer]);
+            }
+            else {
+                transport.receive(peer, received[peer]);
+                transport.send(peer, outbox[peer]);
+            }
+        }
+        for (int peer: peers) {
+            (this->*apply)(peer, received[peer]);
+        }
+    }
+
+    // 1. halo
+
+    void make_halo(int peer, std::vector<char>& message) {
+        float edge = (peer < rank) ? edges[rank] : edges[rank+1];
+        std::vector<Atom*> halo;
+        std::unordered_set<Atom*> added;
+        auto add = [&](Atom* atom) {
+            if (!atom->ghost && added.insert(atom).second) halo.push_back(atom);
+        };
+        for (auto& atom: world.atoms) {
+            if (std::abs(atom->x - edge) <= halo_width) add(atom.get());
+        }
+        // and the atoms bonded to them or to the peer's atoms, however far a bond has stretched:
+        // the bonds of an atom count for its reactions, and pull it before it collides
+        size_t num_near = halo.size();
+        for (size_t i=0;i<num_near;++i) {
+            for (Atom* neighbour: halo[i]->neighbours) add(neighbour);
+        }
+        for (auto& atom: world.atoms) {
+            if (!atom->ghost || owner(atom->x) != peer) continue;
+            for (Atom* neighbour: atom->neighbours) add(neighbour);
+        }
+
+        ByteWriter writer(message);
+        for (Atom* atom: halo) {
+            writer.write(atom->id);
+            writer.write(atom->key);
+            writer.write(atom->x);
+            writer.write(atom->y);
+            writer.write(atom->vx);
+            writer.write(atom->vy);
+            writer.write((int)atom->neighbours.size());
+            for (Atom* neighbour: atom->neighbours) {
+                writer.write(neighbour->id);
+            }
+        }
+    }
+
+    void apply_halo(int peer, const std::vector<char>& message) {
+        update_index();
+        std::unordered_set<int> refreshed;
+        std::vector<std::pair<int,std::vector<int>>> ghost_bonds;     // id and the ids it is bonded to
+        ByteReader reader(message);
+        while (!reader.done()) {
+            int id = reader.read<int>();
+            AtomKey key = reader.read<AtomKey>();
+            int type = key_type(key);
+            int state = key_state(key);
+            float x = reader.read<float>();
+            float y = reader.read<float>();
+            float vx = reader.read<float>();
+            float vy = reader.read<float>();
+            std::vector<int> neighbours(reader.read<int>());
+            for (int& neighbour: neighbours) {
+                neighbour = reader.read<int>();
+            }
+            auto atom = find(id);
+            if (!atom) {
+                atom = world.add_atom(x, y, type, state);
+                atom->id = id;
+                atom->ghost = true;
+                index_of[id] = atom->index;
+            }
+            if (!atom->ghost) continue;
+            atom->x = x;
+            atom->y = y;
+            atom->vx = vx;
+            atom->vy = vy;
+            atom->correction_x = 0;
+            atom->correction_y = 0;
+            atom->correction_n = 0;
+            world.set_state(*atom, state);
+            world.spacemap->update_atom(atom);
+            refreshed.insert(id);
+            ghost_bonds.push_back({id, std::move(neighbours)});
+        }
+        // the bonds of the ghosts as they are in their domain, now that all ghosts are here
+        for (auto& [id, neighbours]: ghost_bonds) {
+            set_bonds(find(id), neighbours);
+        }
+        // ghosts of this peer that are no longer near the edge or bonded to an atom that is
+        std::vector<int> gone;
+        for (auto& atom: world.atoms) {
+            if (atom->ghost && owner(atom->x) == peer && !refreshed.contains(atom->id)) {
+                gone.push_back(atom->index);
+            }
+        }
+        world.remove_atoms(gone);
+    }
+
+    // 3. migration
+
+    void make_migration(int peer, std::vector<char>& message) {
+        std::vector<Atom*> leaving;
+        for (auto& atom: world.atoms) {
+            if (atom->ghost) continue;
+            int new_owner = owner(atom->x);
+            if (new_owner < rank-1 || new_owner > rank+1) {
+                throw std::runtime_error("domain " + std::to_string(rank) + ": atom " + std::to_string(atom->id) + " crossed a whole strip in one step");
+            }
+            if (new_owner == peer) leaving.push_back(atom.get());
+        }
+        // the atoms they are bonded to go along as ghosts, or the bonds would be lost there;
+        // those of the peer are there already
+        std::vector<Atom*> partners;
+        std::unordered_set<Atom*> added(leaving.begin(), leaving.end());
+        for (Atom* atom: leaving) {
+            for (Atom* neighbour: atom->neighbours) {
+                if (neighbour->ghost && owner(neighbour->x) == peer) continue;
+                if (neighbour->ghost) {
+                    throw std::runtime_error("domain " + std::to_string(rank) + ": atom " + std::to_string(atom->id) + " is bonded across more than one strip");
+                }
+                if (added.insert(neighbour).second) partners.push_back(neighbour);
+            }
+        }
+
+        ByteWriter writer(message);
+        for (Atom* atom: leaving) {
+            write_migrating(writer, *atom, false);
+            migrated.push_back(world.atoms[atom->index]);
+        }
+        for (Atom* atom: partners) {
+            write_migrating(writer, *atom, true);
+        }
+    }
+
+    void apply_migration(int /*peer*/, const std::vector<char>& message) {
+        update_index();
+        std::vector<std::pair<int,std::vector<int>>> arrived_bonds;     // id and the ids it is bonded to
+        ByteReader reader(message);
+        while (!reader.done()) {
+            int id = reader.read<int>();
+            AtomKey key = reader.read<AtomKey>();
+            int type = key_type(key);
+            int state = key_state(key);
+            float x = reader.read<float>();
+            float y = reader.read<float>();
+            float vx = reader.read<float>();
+            float vy = reader.read<float>();
+            float motion = reader.read<float>();
+            bool ghost = reader.read<bool>();
+            std::vector<int> neighbours(reader.read<int>());
+            for (int& neighbour: neighbours) {
+                neighbour = reader.read<int>();
+            }
+            auto atom = find(id);
+            // a partner that is here already is refreshed by the next halo
+            if (ghost && atom) continue;
+            if (!atom) {
+                atom = world.add_atom(x, y, type, state);
+                atom->id = id;
+                index_of[id] = atom->index;
+            }
+            atom->ghost = ghost;
+            atom->x = x;
+            atom->y = y;
+            atom->vx = vx;
+            atom->vy = vy;
+            atom->motion = motion;
+            atom->correction_x = 0;
+            atom->correction_y = 0;
+            atom->correction_n = 0;
+            world.set_state(*atom, state);
+            world.spacemap->update_atom(atom);
+            if (!ghost) arrived_bonds.push_back({id, std::move(neighbours)});
+        }
+        // the bonds of the arrived atoms, now that their partners are here; as a ghost, an atom
+        // may have made bonds that its owner didn't
+        for (auto& [id, neighbours]: arrived_bonds) {
+            if (!set_bonds(find(id), neighbours)) {
+                throw std::runtime_error("domain " + std::to_string(rank) + ": atom " + std::to_string(id) + " arrived without the atoms it is bonded to");
+            }
+        }
+    }
+
+    // after migration: the atoms that left are ghosts now; their bonds are kept up to date by the halo
+    void finish_migration() {
+        for (auto& atom: migrated) {
+            atom->ghost = true;
+        }
+        migrated.clear();
+    }
+
+    // --- results ---
+
+    std::vector<DomainAtom> owned_atoms() const {
+        std::vector<DomainAtom> result;
+        for (auto& atom: world.atoms) {
+            if (!atom->ghost) result.push_back({atom->id, atom->key, atom->x, atom->y});
+        }
+        return result;
+    }
+
+    // bonds are counted by the domain that owns the atom with the lowest id
+    int owned_bonds() const {
+        int count = 0;
+        for (auto& bond: world.bonds) {
+            const Atom& first = (bond->atom1->id < bond->atom2->id) ? *bond->atom1 : *bond->atom2;
+            if (!first.ghost) count++;
+        }
+        return count;
+    }
+
+    World world;
+    int rank;
+    int num_domains;
+    std::vector<int> peers;
+    std::vector<float> edges;       // strip of domain i is [edges[i], edges[i+1])
+    float halo_width = 0;
+
+private:
+
+    // atom id to index; indices change when atoms are added or removed
+    void update_index() {
+        index_of.clear();
+        for (auto& atom: world.atoms) {
+            index_of[atom->id] = atom->index;
+        }
+    }
+
+    // the bonds of atom as they are in its own domain: with the atoms of neighbour_ids that are
+    // here; false if some aren't
+    bool set_bonds(const std::shared_ptr<Atom>& atom, const std::vector<int>& neighbour_ids) {
+        std::vector<Atom*> old_neighbours = atom->neighbours;
+        for (Atom* neighbour: old_neighbours) {
+            if (std::find(neighbour_ids.begin(), neighbour_ids.end(), neighbour->id) == neighbour_ids.end()) {
+                world.remove_bond(world.make_atom_pair(atom.get(), neighbour));
+            }
+        }
+        bool all_here = true;
+        for (int neighbour_id: neighbour_ids) {
+            auto neighbour = find(neighbour_id);
+            if (!neighbour) all_here = false;
+            else if (!world.atompair2bond.contains(world.make_atom_pair(atom.get(), neighbour.get()))) {
+                world.add_bond(atom, neighbour);
+            }
+        }
+        return all_here;
+    }
+
+    void write_migrating(ByteWriter& writer, const Atom& atom, bool ghost) {
+        writer.write(atom.id);
+        writer.write(atom.key);
+        writer.write(atom.x);
+        writer.write(atom.y);
+        writer.write(atom.vx);
+        writer.write(atom.vy);
+        writer.write(atom.motion);
+        writer.write(ghost);
+        writer.write((int)atom.neighbours.size());
+        for (Atom* neighbour: atom.neighbours) {
+            writer.write(neighbour->id);
+        }
+    }
+
+    std::shared_ptr<Atom> find(int id) {
+        auto it = index_of.find(id);
+        if (it == index_of.end()) return nullptr;
+        auto& atom = world.atoms[it->second];
+        return (atom->id == id) ? atom : nullptr;
+    }
+
+    std::map<int,std::vector<char>> outbox;
+    std::vector<char> inbox;
+    std::unordered_map<int,int> index_of;
+    std::vector<std::shared_ptr<Atom>> migrated;
+};
+
+struct DomainResult {
+    std::vector<DomainAtom> atoms;      // sorted by id
+    int bonds = 0;
+};
+
+// all domains in this process, taking turns
+inline DomainResult run_domains(int num_domains, int steps, const std::function<void(World&)>& setup) {
+    std::vector<std::unique_ptr<Domain>> domains;
+    std::map<std::pair<int,int>,std::vector<char>> mailboxes;
+    std::vector<std::unique_ptr<LoopbackTransport>> transports;
+    for (int rank=0;rank<num_domains;++rank) {
+        domains.push_back(std::make_unique<Domain>(rank, num_domains, setup));
+        transports.push_back(std::make_unique<LoopbackTransport>(rank, mailboxes));
+    }
+    auto phase = [&](Domain::Make make, Domain::Apply apply) {
+        for (int rank=0;rank<num_domains;++rank) domains[rank]->send_all(*transports[rank], make);
+        for (int rank=0;rank<num_domains;++rank) domains[rank]->receive_all(*transports[rank], apply);
+    };
+    for (int step=0;step<steps;++step) {
+        phase(&Domain::make_halo, &Domain::apply_halo);
+        for (auto& domain: domains) domain->world.update();
+        phase(&Domain::make_migration, &Domain::apply_migration);
+        for (auto& domain: domains) domain->finish_migration();
+    }
+    DomainResult result;
+    for (auto& domain: domains) {
+        auto atoms = domain->owned_atoms();
+        result.atoms.insert(result.atoms.end(), atoms.begin(), atoms.end());
+        result.bonds += domain->owned_bonds();
+    }
+    std::sort(result.atoms.begin(), result.atoms.end(), [](auto& a, auto& b) { return a.id < b.id; });
+    return result;
+}
+
+// each domain in a process of its own, forked from this one and connected to
+// its neighbours by Unix sockets; the results are sent back to this process
+inline DomainResult run_domain_processes(int num_domains, int steps, const std::function<void(World&)>& setup) {
+    // sockets between neighbours, and from each domain back to here; -1 once closed here
+    std::vector<std::array<int,2>> links(num_domains, {-1, -1});     // link i connects domain i and i+1
+    std::vector<std::array<int,2>> results(num_domains, {-1, -1});
+    auto close_fd = [](int& fd) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    };
+    auto close_all = [&]() {
+        for (int i=0;i<num_domains;++i) {
+            close_fd(links[i][0]);
+            close_fd(links[i][1]);
+            close_fd(results[i][0]);
+            close_fd(results[i][1]);
+        }
+    };
+    for (int i=0;i<num_domains;++i) {
+        bool failed = (i < num_domains-1 && socketpair(AF_UNIX, SOCK_STREAM, 0, links[i].data()) != 0)
+                   || socketpair(AF_UNIX, SOCK_STREAM, 0, results[i].data()) != 0;
+        if (failed) {
+            close_all();
+            throw std::runtime_error("socketpair failed");
+        }
+    }
+
+    // or the children would write out what is still buffered here too
+    std::cout.flush();
+    std::fflush(stdout);
+    std::vector<pid_t> children;
+    for (int rank=0;rank<num_domains;++rank) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            // the children so far fail when their sockets close
+            close_all();
+            for (pid_t child: children) waitpid(child, nullptr, 0);
+            throw std::runtime_error("fork failed");
+        }
+        if (pid > 0) {
+            children.push_back(pid);
+            // the ends of the children, so that they see the others go when one of them fails
+            close_fd(results[rank][1]);
+            if (rank > 0) {
+                close_fd(links[rank-1][0]);
+                close_fd(links[rank-1][1]);
+            }
+            continue;
+        }
+        // child: only its own ends stay open
+        int status = 0;
+        try {
+            int own[3] = {rank > 0 ? links[rank-1][1] : -1, rank < num_domains-1 ? links[rank][0] : -1, results[rank][1]};
+            for (int i=0;i<num_domains;++i) {
+                for (int* fd: {&links[i][0], &links[i][1], &results[i][0], &results[i][1]}) {
+                    if (std::find(std::begin(own), std::end(own), *fd) == std::end(own)) close_fd(*fd);
+                }
+            }
+            SocketTransport transport;
+            if (rank > 0) transport.connect(rank-1, own[0]);
+            if (rank < num_domains-1) transport.connect(rank+1, own[1]);
+            transport.connect(-1, own[2]);
+            Domain domain(rank, num_domains, setup);
+            for (int step=0;step<steps;++step) {
+                domain.step(transport);
+            }
+            std::vector<char> message;
+            ByteWriter writer(message);
+            writer.write(domain.owned_bonds());
+            for (auto& atom: domain.owned_atoms()) {
+                writer.write(atom);
+            }
+            transport.send(-1, message);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "domain " << rank << ": " << e.what() << "\n";
+            status = 1;
+        }
+        _exit(status);
+    }
+
+    DomainResult result;
+    std::string error;
+    try {
+        SocketTransport transport;
+        for (int rank=0;rank<num_domains;++rank) {
+            transport.connect(rank, results[rank][0]);
+        }
+        for (int rank=0;rank<num_domains;++rank) {
+            std::vector<char> message;
+            transport.receive(rank, message);
+            ByteReader reader(message);
+            result.bonds += reader.read<int>();
+            while (!reader.done()) {
+                result.atoms.push_back(reader.read<DomainAtom>());
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        error = e.what();
+    }
+    close_all();
+    int num_failed = 0;
+    for (pid_t pid: children) {
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) num_failed++;
+    }
+    if (num_failed > 0) throw std::runtime_error(std::to_string(num_failed) + " of " + std::to_string(num_domains) + " domain processes failed");
+    if (!error.empty()) throw std::runtime_error(error);
+    std::sort(result.atoms.begin(), result.atoms.end(), [](auto& a, auto& b) { return a.id < b.id; });
+    return result;
+}
+
+// the world that the domains split, whole, with the same decomposable steps; for comparison
+inline DomainResult run_whole(int steps, const std::function<void(World&)>& setup) {
+    World world;
+    setup(world);
+    world.decomposable = true;
+    world.restart();
+    for (int step=0;step<steps;++step) {
+        world.update();
+    }
+    DomainResult result;
+    for (auto& atom: world.atoms) {
+        result.atoms.push_back({atom->id, atom->key, atom->x, atom->y});
+    }
+    result.bonds = world.bonds.size();
+    std::sort(result.atoms.begin(), result.atoms.end(), [](auto& a, auto& b) { return a.id < b.id; });
+    return result;
+}
+
+// the first atom in which two results differ, bit for bit, or -1 if they are the same;
+// the number of atoms if only the number of atoms or bonds differs
+inline int first_difference(const DomainResult& a, const DomainResult& b) {
+    auto same = [](const DomainAtom& p, const DomainAtom& q) {
+        return p.id == q.id && p.key == q.key
+            && std::bit_cast<uint32_t>(p.x) == std::bit_cast<uint32_t>(q.x)
+            && std::bit_cast<uint32_t>(p.y) == std::bit_cast<uint32_t>(q.y);
+    };
+    size_t n = std::min(a.atoms.size(), b.atoms.size());
+    for (size_t i=0;i<n;++i) {
+        if (!same(a.atoms[i], b.atoms[i])) return i;
+    }
+    if (a.atoms.size() != b.atoms.size() || a.bonds != b.bonds) return n;
+    return -1;
+}
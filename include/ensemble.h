@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "world.h"
+
+// An ensemble is a parameter sweep: every combination of the listed parameter values,
+// rule files and seeds is simulated as an independent world. Runs are spread over a pool
+// of threads and their time series are written to one CSV table.
+//
+// The sweep is described in a text file with one "key = values" line per setting, e.g.
+//
+//   # two temperatures, three bonding strengths, four seeds: 24 runs
+//   temp = 0.05 0.1
+//   bonding_strength = 0.05 0.1 0.2
+//   seeds = 1 2 3 4
+//   rules = rules.txt
+//   steps = 10000
+//   sample_interval = 100
+//   atoms = 100
+//   threads = 0
+//   output = ensemble.csv
+//
+// Any parameter known to PhysicsParameters::set() can be swept.
+// threads = 0 uses all hardware threads.
+struct EnsembleSpec
+{
+    struct Sweep {
+        std::string name;
+        std::vector<float> values;
+    };
+
+    struct Run {
+        int id;
+        uint64_t seed;
+        std::string rule_file;
+        std::vector<float> values;     // one for each sweep
+    };
+
+    std::vector<Sweep> sweeps;
+    std::vector<std::string> rule_files;
+    std::vector<uint64_t> seeds = {1};
+    int steps = 1000;
+    int sample_interval = 100;
+    int atoms = 16;                 // start atoms of each type
+    int threads = 0;
+    std::string output = "ensemble.csv";
+
+    bool load(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) {
+            std::cerr << "cannot open ensemble file " << filename << "\n";
+            return false;
+        }
+        std::string line;
+        int line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') continue;
+            auto equals = line.find('=');
+            if (equals == std::string::npos) {
+                std::cerr << filename << ":" << line_number << ": expected key = values\n";
+                return false;
+            }
+            std::istringstream key_stream(line.substr(0, equals));
+            std::istringstream values(line.substr(equals+1));
+            std::string key;
+            key_stream >> key;
+            if (key == "rules") {
+                rule_files.clear();
+                std::string rule_file;
+                while (values >> rule_file) rule_files.push_back(rule_file);
+            }
+            else if (key == "seeds") {
+                seeds.clear();
+                uint64_t seed;
+                while (values >> seed) seeds.push_back(seed);
+            }
+            else if (key == "steps") values >> steps;
+            else if (key == "sample_interval") values >> sample_interval;
+            else if (key == "atoms") values >> atoms;
+            else if (key == "threads") values >> threads;
+            else if (key == "output") values >> output;
+            else if (PhysicsParameters().set(key, 0)) {
+                Sweep sweep {key, {}};
+                float value;
+                while (values >> value) sweep.values.push_back(value);
+                sweeps.push_back(sweep);
+            }
+            else {
+                std::cerr << filename << ":" << line_number << ": unknown key " << key << "\n";
+                return false;
+            }
+        }
+        if (seeds.empty() || sample_interval <= 0) {
+            std::cerr << filename << ": need at least one seed and a positive sample_interval\n";
+            return false;
+        }
+        return true;
+    }
+
+    // all combinations of sweep values, rule files and seeds
+    std::vector<Run> runs() const {
+        std::vector<Run> runs;
+        std::vector<std::string> files = rule_files.empty() ? std::vector<std::string>{""} : rule_files;
+        std::vector<int> counter(sweeps.size(), 0);
+        while (true) {
+            std::vector<float> values;
+            for (int i=0;i<sweeps.size();++i) {
+                if (sweeps[i].values.empty()) return {};
+                values.push_back(sweeps[i].values[counter[i]]);
+            }
+            for (auto& file: files) {
+                for (auto seed: seeds) {
+                    runs.push_back({(int)runs.size(), seed, file, values});
+                }
+            }
+            // next combination, last sweep fastest
+            int i = sweeps.size()-1;
+            while (i >= 0 && ++counter[i] == sweeps[i].values.size()) {
+                counter[i] = 0;
+                i--;
+            }
+            if (i < 0) break;
+        }
+        return runs;
+    }
+};
+
+class Ensemble
+{
+public:
+
+    Ensemble(const EnsembleSpec& spec): spec(spec), runs(spec.runs()) {}
+
+    bool run() {
+        // check the rule files once, before starting
+        for (auto& rule_file: spec.rule_files) {
+            World world;
+            if (!world.load_rules(rule_file)) return false;
+        }
+
+        int num_threads = spec.threads > 0 ? spec.threads : std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min<int>(num_threads, runs.size());
+        std::cout << runs.size() << " runs on " << num_threads << " threads\n";
+
+        results.assign(runs.size(), "");
+        std::vector<std::thread> pool;
+        for (int i=0;i<num_threads;++i) {
+            pool.emplace_back([this]() { worker(); });
+        }
+        for (auto& thread: pool) {
+            thread.join();
+        }
+
+        std::ofstream file(spec.output);
+        if (!file) {
+            std::cerr << "cannot write " << spec.output << "\n";
+            return false;
+        }
+        file << "run,seed,rules";
+        for (auto& sweep: spec.sweeps) {
+            file << "," << sweep.name;
+        }
+        file << ",step,atoms,bonds,rules_applied,sleeping,clusters,largest_cluster\n";
+        for (auto& result: results) {
+            file << result;
+        }
+        return true;
+    }
+
+private:
+
+    void worker() {
+        while (true) {
+            int i = next_run++;
+            if (i >= runs.size()) return;
+            results[i] = simulate(runs[i]);
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "run " << i+1 << "/" << runs.size() << " finished\n";
+        }
+    }
+
+    // simulate one run in its own world; returns its rows of the table
+    std::string simulate(const EnsembleSpec::Run& run) const {
+        World world;
+        world.random.seed(run.seed);
+        world.start_atoms.assign(world.start_atoms.size(), spec.atoms);
+        for (int i=0;i<spec.sweeps.size();++i) {
+            world.params.set(spec.sweeps[i].name, run.values[i]);
+        }
+        if (!run.rule_file.empty()) world.load_rules(run.rule_file);
+        world.restart();
+
+        std::ostringstream prefix;
+        prefix << run.id << "," << run.seed << "," << run.rule_file;
+        for (float value: run.values) {
+            prefix << "," << value;
+        }
+
+        std::ostringstream rows;
+        long rules_applied = 0;
+        for (int step=1;step<=spec.steps;++step) {
+            world.update();
+            rules_applied += world.debug_num_rules_applied;
+            if (step % spec.sample_interval == 0) {
+                rows << prefix.str() << "," << step
+                     << "," << world.atoms.size()
+                     << "," << world.bonds.size()
+                     << "," << rules_applied
+                     << "," << world.num_sleeping
+                     << "," << world.clusters.num_clusters
+                     << "," << world.clusters.largest() << "\n";
+                rules_applied = 0;
+            }
+        }
+        return rows.str();
+    }
+
+    const EnsembleSpec& spec;
+    std::vector<EnsembleSpec::Run> runs;
+    std::vector<std::string> results;       // rows of each run; each is written by one thread only
+    std::atomic<int> next_run = 0;
+    std::mutex output_mutex;                // for the progress lines
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "atomrenderer.h"
+#include "png.h"
+#include "scene.h"
+#include "world.h"
+
+// Renders frames of a world without a window, so it also runs on machines without a display or
+// GPU: each frame is drawn with SDL's software renderer into a surface in memory, and written as
+// a PNG file, and/or appended to a raw video stream of RGBA frames, e.g. for
+//   ffmpeg -f rawvideo -pix_fmt rgba -s 1280x720 -r 30 -i frames.rgba video.mp4
+//
+// add() only copies what is drawn (a Scene); the frames are drawn and written by a pool of worker
+// threads, so that drawing frame N overlaps simulating frame N+1. At most max_pending frames
+// wait at a time; add() blocks until there is room. The raw stream is written in frame order.
+// PNG files and raw frames that can't be written are counted, see finish().
+// Needs TTF_Init() for the atom labels.
+class FrameExporter
+{
+public:
+
+    struct Options {
+        int width = 1280;
+        int height = 720;
+        std::string png_pattern;        // printf pattern of the frame number, e.g. "frame%05d.png"; empty: no PNG files
+        std::string raw_filename;       // raw RGBA stream; "-" is stdout; empty: no stream
+        int threads = 0;                // 0: all hardware threads
+        int max_pending = 8;
+    };
+
+    FrameExporter(const Options& options): options(options) {
+        if (!options.raw_filename.empty()) {
+            raw_file = (options.raw_filename == "-") ? stdout : fopen(options.raw_filename.c_str(), "wb");
+        }
+        int num_threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        for (int i=0;i<num_threads;++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~FrameExporter() {
+        finish();
+    }
+
+    bool ok() const {
+        return options.raw_filename.empty() || raw_file;
+    }
+
+    // queue a frame of the world as it is now
+    void add(const World& world) {
+        auto scene = std::make_unique<Scene>();
+        scene->capture(world);
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [&]() { return num_pending < options.max_pending; });
+        num_pending++;
+        jobs.push_back({num_frames++, std::move(scene)});
+        job_added.notify_one();
+    }
+
+    // wait until all frames are written; returns the number of PNG files and raw frames (and the
+    // final flush of the stream) that failed
+    int finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_added.notify_all();
+        for (auto& worker: workers) {
+            worker.join();
+        }
+        workers.clear();
+        if (raw_file && raw_file != stdout && fclose(raw_file) != 0) num_failed++;
+        else if (raw_file == stdout && fflush(raw_file) != 0) num_failed++;
+        raw_file = nullptr;
+        return num_failed;
+    }
+
+    int frames() const { return num_frames; }
+    int failed() const { return num_failed; }
+
+private:
+
+    struct Job {
+        int frame;
+        std::unique_ptr<Scene> scene;
+    };
+
+    void work() {
+        // each worker has its own surface and renderer, and with it its own atom textures
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, options.width, options.height, 32, SDL_PIXELFORMAT_RGBA32);
+        SDL_Renderer* renderer = SDL_CreateSoftwareRenderer(surface);
+        auto atom_renderer = std::make_unique<AtomRenderer>(*renderer);
+        std::vector<uint8_t> pixels;
+
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_added.wait(lock, [&]() { return !jobs.empty() || stopping; });
+                if (jobs.empty()) break;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            // the world fills the frame, centered
+            const Scene& scene = *job.scene;
+            float scale = std::min(options.width / scene.width, options.height / scene.height);
+            float offset_x = (options.width - scene.width * scale) / 2;
+            float offset_y = (options.height - scene.height * scale) / 2;
+            scene.draw(*renderer, *atom_renderer, options.width, options.height, scale, offset_x, offset_y);
+            SDL_RenderFlush(renderer);
+
+            SDL_LockSurface(surface);
+            pixels.resize((size_t)options.width * options.height * 4);
+            for (int y=0;y<options.height;++y) {
+                const uint8_t* row = static_cast<const uint8_t*>(surface->pixels) + (size_t)y * surface->pitch;
+                std::copy_n(row, options.width * 4, &pixels[(size_t)y * options.width * 4]);
+            }
+            SDL_UnlockSurface(surface);
+
+            if (!options.png_pattern.empty()) {
+                char filename[1024];
+                snprintf(filename, sizeof(filename), options.png_pattern.c_str(), job.frame);
+                if (!PngWriter::write(filename, pixels.data(), options.width, options.height, options.width * 4)) {
+                    num_failed++;
+                }
+            }
+            if (raw_file) {
+                write_in_order(job.frame, pixels);
+            }
+            else {
+                done();
+            }
+        }
+
+        atom_renderer.reset();
+        SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+    }
+
+    // frames may be finished out of order; whoever finishes the next frame writes it, and any that follow it
+    void write_in_order(int frame, std::vector<uint8_t>& pixels) {
+        std::unique_lock<std::mutex> lock(write_mutex);
+        finished[frame] = std::move(pixels);
+        while (!finished.empty() && finished.begin()->first == next_to_write) {
+            auto frame_pixels = std::move(finished.begin()->second);
+            finished.erase(finished.begin());
+            if (fwrite(frame_pixels.data(), 1, frame_pixels.size(), raw_file) != frame_pixels.size()) {
+                num_failed++;
+            }
+            next_to_write++;
+            done();
+        }
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        num_pending--;
+        room.notify_one();
+    }
+
+    Options options;
+    FILE* raw_file = nullptr;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;                   // for the jobs
+    std::condition_variable job_added;
+    std::condition_variable room;
+    std::deque<Job> jobs;
+    int num_frames = 0;
+    int num_pending = 0;                // added but not written
+    bool stopping = false;
+
+    std::mutex write_mutex;             // for the raw stream
+    std::map<int,std::vector<uint8_t>> finished;
+    int next_to_write = 0;
+
+    std::atomic<int> num_failed = 0;    // failed writes, see finish()
+};
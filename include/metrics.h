@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "world.h"
+
+// Live metrics of a headless run, in the Prometheus text format, served over HTTP on a port of
+// localhost (e.g. curl localhost:9100/metrics) or on a Unix socket: steps per second, phase
+// timings (with -DPROFILER), atom and bond counts, the population per type and state, rule
+// statistics and memory use, the same numbers as the Statistics, Population and Rules panels.
+//
+// The simulation thread calls publish() after every step; about once per publish_interval it
+// stores the numbers in atomics, which the server thread reads when it is scraped. Neither thread
+// ever waits for the other, so the numbers of one scrape may come from two publishes.
+class MetricsServer
+{
+public:
+
+    // port > 0: on 127.0.0.1:port, else on a Unix socket at socket_path
+    MetricsServer(const World& world, int port, const std::string& socket_path = "")
+        : key_atoms(num_keys), bond_counts(max_types * (max_types+1) / 2) {
+        for (auto& rule: world.rules) {
+            rule_names.push_back(rule->toText());
+        }
+        rule_stats = std::vector<RuleValues>(rule_names.size());
+        listen_fd = port > 0 ? listen_tcp(port) : listen_unix(socket_path);
+        if (listen_fd < 0) {
+            std::cerr << "cannot serve metrics on " << (port > 0 ? "port " + std::to_string(port) : socket_path)
+                      << ": " << strerror(errno) << "\n";
+            return;
+        }
+        this->socket_path = port > 0 ? "" : socket_path;
+        last_publish = Clock::now();
+        server = std::thread([this]() { serve(); });
+    }
+
+    ~MetricsServer() {
+        stopping = true;
+        if (server.joinable()) server.join();
+        if (listen_fd >= 0) close(listen_fd);
+        if (!socket_path.empty()) unlink(socket_path.c_str());
+    }
+
+    bool ok() const { return listen_fd >= 0; }
+
+    // on the simulation thread, after a step
+    void publish(const World& world) {
+        steps_since_publish++;
+        auto now = Clock::now();
+        std::chrono::duration<double> elapsed = now - last_publish;
+        if (published && elapsed.count() < publish_interval) return;
+        published = true;
+        last_publish = now;
+        double steps_per_second = steps_since_publish / elapsed.count();
+        set(values.steps_per_second, steps_per_second);
+        set(values.simulated_time_per_second, steps_per_second * world.params.dt);
+#ifdef PROFILER
+        // mean duration per step of each phase since the last publish
+        const Profiler& profiler = world.profiler;
+        int frames = std::min(profiler.size(), steps_since_publish);
+        for (int phase=0;phase<Profiler::num_phases;++phase) {
+            double total = 0;
+            for (int i=profiler.size()-frames;i<profiler.size();++i) {
+                total += profiler.frame(i).durations_ms[phase];
+            }
+            set(phase_seconds[phase], frames > 0 ? total / frames / 1000 : 0);
+        }
+#endif
+        steps_since_publish = 0;
+
+        set(values.steps, world.step_count);
+        set(values.simulated_time, world.time);
+        set(values.atoms, world.atoms.size());
+        set(values.bonds, world.bonds.size());
+        set(values.molecules, world.clusters.num_clusters);
+        set(values.largest_molecule, world.clusters.largest());
+        set(values.sleeping_atoms, world.num_sleeping);
+        set(values.sleeping_islands, world.islands.size());
+        set(values.pairs_tested, world.debug_num_pairs_tested);
+        set(values.rules_tested, world.debug_num_rules_tested);
+        set(values.rules_applied, world.debug_num_rules_applied);
+        set(values.atom_reorders, world.debug_num_reorders);
+        set(values.mean_atom_stride, world.mean_atom_stride());
+        auto memory = world.memory_usage();
+        set(values.memory_atoms, memory.atoms);
+        set(values.memory_bonds, memory.bonds);
+        set(values.memory_spacemap, memory.spacemap);
+
+        const Population& population = world.population;
+        int types = std::min(population.num_types, max_types);
+        int states = std::min(population.num_states, max_states);
+        for (int type=0;type<types;++type) {
+            for (int state=0;state<states;++state) {
+                key_atoms[atom_key(type, state)].store(population.atoms(type, state), std::memory_order_relaxed);
+            }
+            for (int other=0;other<=type;++other) {
+                bond_counts[Population::bond_type(other, type)].store(population.bonds(other, type), std::memory_order_relaxed);
+            }
+        }
+        num_types.store(types, std::memory_order_release);
+        num_states.store(states, std::memory_order_release);
+
+        for (int r=0;r<rule_stats.size() && r<world.rules.size();++r) {
+            const RuleStats& stats = world.rules[r]->stats;
+            set(rule_stats[r].attempts, stats.attempts);
+            set(rule_stats[r].hits, stats.hits);
+            set(rule_stats[r].blocked, stats.blocked);
+            set(rule_stats[r].seconds, stats.time);
+        }
+    }
+
+    double publish_interval = 1.0;     // seconds
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Values {
+        std::atomic<double> steps = 0;
+        std::atomic<double> steps_per_second = 0;
+        std::atomic<double> simulated_time = 0;
+        std::atomic<double> simulated_time_per_second = 0;
+        std::atomic<double> atoms = 0;
+        std::atomic<double> bonds = 0;
+        std::atomic<double> molecules = 0;
+        std::atomic<double> largest_molecule = 0;
+        std::atomic<double> sleeping_atoms = 0;
+        std::atomic<double> sleeping_islands = 0;
+        std::atomic<double> pairs_tested = 0;
+        std::atomic<double> rules_tested = 0;
+        std::atomic<double> rules_applied = 0;
+        std::atomic<double> atom_reorders = 0;
+        std::atomic<double> mean_atom_stride = 0;
+        std::atomic<double> memory_atoms = 0;
+        std::atomic<double> memory_bonds = 0;
+        std::atomic<double> memory_spacemap = 0;
+    };
+
+    struct RuleValues {
+        std::atomic<double> attempts = 0;
+        std::atomic<double> hits = 0;
+        std::atomic<double> blocked = 0;
+        std::atomic<double> seconds = 0;
+    };
+
+    static void set(std::atomic<double>& value, double v) {
+        value.store(v, std::memory_order_relaxed);
+    }
+
+    static double get(const std::atomic<double>& value) {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    // --- the server thread ---
+
+    static int listen_tcp(int port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);      // not reachable from other machines
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 8) != 0) {
+            int error = errno;      // for the message
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+
+    static int listen_unix(const std::string& path) {
+        sockaddr_un address {};
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        unlink(path.c_str());       // left by an earlier run
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 8) != 0) {
+            int error = errno;      // for the message
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+
+    void serve() {
+        while (!stopping) {
+            // wake up now and then to see if we should stop
+            pollfd waiting = {listen_fd, POLLIN, 0};
+            if (poll(&waiting, 1, 200) <= 0) continue;
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) continue;
+            timeval timeout = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            respond(fd);
+            close(fd);
+        }
+    }
+
+    void respond(int fd) {
+        // the request line and headers; the body of a GET is empty
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            request.append(buffer, n);
+        }
+        std::string status = "200 OK";
+        std::string body;
+        if (request.starts_with("GET /metrics ") || request.starts_with("GET / ")) {
+            body = render();
+        }
+        else {
+            status = "404 Not Found";
+            body = "see /metrics\n";
+        }
+        std::string response = "HTTP/1.1 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+        for (size_t sent=0;sent<response.size();) {
+            ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += n;
+        }
+    }
+
+    std::string render() const {
+        std::ostringstream out;
+        out.precision(10);
+        auto family = [&](const char* name, const char* type, const char* help) {
+            out << "# HELP organicsoup_" << name << " " << help << "\n";
+            out << "# TYPE organicsoup_" << name << " " << type << "\n";
+        };
+        auto metric = [&](const char* name, const char* type, const char* help, const std::atomic<double>& value) {
+            family(name, type, help);
+            out << "organicsoup_" << name << " " << get(value) << "\n";
+        };
+        // label values are escaped as the format asks; rule texts have none of \ " or newline, but to be sure
+        auto label = [](const std::string& text) {
+            std::string escaped;
+            for (char c: text) {
+                if (c == '\\' || c == '"') escaped += '\\';
+                if (c == '\n') { escaped += "\\n"; continue; }
+                escaped += c;
+            }
+            return escaped;
+        };
+
+        metric("steps_total", "counter", "Steps simulated", values.steps);
+        metric("steps_per_second", "gauge", "Steps per second of wall time", values.steps_per_second);
+        metric("simulated_time", "gauge", "Simulated time", values.simulated_time);
+        metric("simulated_time_per_second", "gauge", "Simulated time per second of wall time", values.simulated_time_per_second);
+        metric("atoms", "gauge", "Number of atoms", values.atoms);
+        metric("bonds", "gauge", "Number of bonds", values.bonds);
+        metric("molecules", "gauge", "Number of molecules, including single atoms", values.molecules);
+        metric("largest_molecule_atoms", "gauge", "Atoms in the largest molecule", values.largest_molecule);
+        metric("sleeping_atoms", "gauge", "Sleeping atoms", values.sleeping_atoms);
+        metric("sleeping_islands", "gauge", "Sleeping islands", values.sleeping_islands);
+        metric("pairs_tested", "gauge", "Pairs tested in the last step", values.pairs_tested);
+        metric("rules_tested", "gauge", "Rules tested in the last step", values.rules_tested);
+        metric("rules_applied", "gauge", "Rules applied in the last step", values.rules_applied);
+        metric("atom_reorders_total", "counter", "Times the atoms were reordered in memory", values.atom_reorders);
+        metric("mean_atom_stride_bytes", "gauge", "Mean distance in memory between consecutive atoms", values.mean_atom_stride);
+
+        family("memory_bytes", "gauge", "Memory used, by part");
+        out << "organicsoup_memory_bytes{part=\"atoms\"} " << get(values.memory_atoms) << "\n";
+        out << "organicsoup_memory_bytes{part=\"bonds\"} " << get(values.memory_bonds) << "\n";
+        out << "organicsoup_memory_bytes{part=\"spacemap\"} " << get(values.memory_spacemap) << "\n";
+
+#ifdef PROFILER
+        family("phase_seconds", "gauge", "Mean time per step of each phase");
+        for (int phase=0;phase<Profiler::num_phases;++phase) {
+            out << "organicsoup_phase_seconds{phase=\"" << phase_names[phase] << "\"} " << get(phase_seconds[phase]) << "\n";
+        }
+#endif
+
+        int types = num_types.load(std::memory_order_acquire);
+        int states = num_states.load(std::memory_order_acquire);
+        family("population_atoms", "gauge", "Atoms of each type and state");
+        for (int type=0;type<types;++type) {
+            for (int state=0;state<states;++state) {
+                out << "organicsoup_population_atoms{type=\"" << label(type_name(type)) << "\",state=\"" << state << "\"} "
+                    << key_atoms[atom_key(type, state)].load(std::memory_order_relaxed) << "\n";
+            }
+        }
+        family("population_bonds", "gauge", "Bonds between atoms of each pair of types");
+        for (int bond_type=0;bond_type<types*(types+1)/2;++bond_type) {
+            out << "organicsoup_population_bonds{types=\"" << label(Population::bond_type_name(bond_type)) << "\"} "
+                << bond_counts[bond_type].load(std::memory_order_relaxed) << "\n";
+        }
+
+        if (!rule_names.empty()) {
+            family("rule_attempts_total", "counter", "Times a rule was tested, estimated from the sampled pairs");
+            for (int r=0;r<rule_names.size();++r) {
+                out << "organicsoup_rule_attempts_total{rule=\"" << label(rule_names[r]) << "\"} " << get(rule_stats[r].attempts) << "\n";
+            }
+            family("rule_hits_total", "counter", "Times a rule matched");
+            for (int r=0;r<rule_names.size();++r) {
+                out << "organicsoup_rule_hits_total{rule=\"" << label(rule_names[r]) << "\"} " << get(rule_stats[r].hits) << "\n";
+            }
+            family("rule_blocked_total", "counter", "Matches of a rule that made no bond because of max_bonds_per_atom");
+            for (int r=0;r<rule_names.size();++r) {
+                out << "organicsoup_rule_blocked_total{rule=\"" << label(rule_names[r]) << "\"} " << get(rule_stats[r].blocked) << "\n";
+            }
+            family("rule_seconds_total", "counter", "Time spent on a rule, estimated from the sampled pairs");
+            for (int r=0;r<rule_names.size();++r) {
+                out << "organicsoup_rule_seconds_total{rule=\"" << label(rule_names[r]) << "\"} " << get(rule_stats[r].seconds) << "\n";
+            }
+        }
+        return out.str();
+    }
+
+    // written by publish(), read by render()
+    Values values;
+    std::vector<std::atomic<int>> key_atoms;        // by AtomKey
+    std::vector<std::atomic<int>> bond_counts;      // by Population::bond_type()
+    std::atomic<int> num_types = 0;                 // of the population published so far
+    std::atomic<int> num_states = 0;
+    std::vector<std::string> rule_names;            // of the rules at the start; they don't change headless
+    std::vector<RuleValues> rule_stats;
+#ifdef PROFILER
+    std::array<std::atomic<double>,Profiler::num_phases> phase_seconds {};
+#endif
+
+    // only used by publish()
+    bool published = false;
+    Clock::time_point last_publish;
+    int steps_since_publish = 0;
+
+    int listen_fd = -1;
+    std::string socket_path;            // to remove at the end
+    std::atomic<bool> stopping = false;
+    std::thread server;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Morton (Z-order) curve helpers, used to sort atoms so that atoms close
+// in space are also close in memory.
+
+// spread the lower 16 bits of v over the even bits
+inline uint32_t morton_spread(uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+inline uint32_t morton_code(int ix, int iy) {
+    return morton_spread(ix) | (morton_spread(iy) << 1);
+}
+
+// Returns the permutation that sorts keys in ascending order. 
+// LSD radix sort with 8-bit digits, O(n); passes on digits that are 
+// equal for all keys are skipped. The sort is stable.
+inline std::vector<int> radix_sort_order(const std::vector<uint32_t>& keys) {
+    int n = keys.size();
+    std::vector<int> order(n);
+    std::vector<int> buffer(n);
+    for (int i=0;i<n;++i) order[i] = i;
+
+    for (int shift=0;shift<32;shift+=8) {
+        int count[257] = {0};
+        for (int i=0;i<n;++i) {
+            count[((keys[i] >> shift) & 0xff) + 1]++;
+        }
+        bool single_bucket = false;
+        for (int d=1;d<=256;++d) {
+            if (count[d] == n) single_bucket = true;
+        }
+        if (single_bucket) continue;
+        for (int d=0;d<256;++d) {
+            count[d+1] += count[d];
+        }
+        for (int i=0;i<n;++i) {
+            int index = order[i];
+            buffer[count[(keys[index] >> shift) & 0xff]++] = index;
+        }
+        order.swap(buffer);
+    }
+    return order;
+}
@@ -1,9 +1,23 @@
 #pragma once
 
+#include <string>
+
+#include "boundary.h"
+
+enum class Integrator {
+    euler,      // bond forces and velocities, then positions, once per step
+    verlet,     // velocity Verlet for the bond forces, with bond_substeps per step
+};
+
 struct PhysicsParameters
 {
     float space_width = 1600;
     float space_height = 900;
+    Boundary boundary = Boundary::reflect;
+
+    Integrator integrator = Integrator::euler;
+    float dt = 1.0f;            // time step
+    int bond_substeps = 1;      // Verlet substeps of the bond forces per step
 
     float temp = 0.1f; // Brownian motion temperature
     float friction = 0.01f; // friction coefficient
@@ -17,4 +31,25 @@ struct PhysicsParameters
     float bonding_strength = 0.1f;       // strength of bonding spring between atoms
 
     int max_bonds_per_atom = 6;
+
+    bool operator==(const PhysicsParameters&) const = default;
+
+    // set a parameter by its name, e.g. for parameter sweeps; returns false for unknown names
+    bool set(const std::string& name, float value) {
+        if (name == "space_width") space_width = value;
+        else if (name == "space_height") space_height = value;
+        else if (name == "dt") dt = value;
+        else if (name == "bond_substeps") bond_substeps = value;
+        else if (name == "integrator") integrator = static_cast<Integrator>(value);
+        else if (name == "temp") temp = value;
+        else if (name == "friction") friction = value;
+        else if (name == "collision_elasticity") collision_elasticity = value;
+        else if (name == "bonding_distance") bonding_distance = value;
+        else if (name == "bonding_start_distance") bonding_start_distance = value;
+        else if (name == "bonding_end_distance") bonding_end_distance = value;
+        else if (name == "bonding_strength") bonding_strength = value;
+        else if (name == "max_bonds_per_atom") max_bonds_per_atom = value;
+        else return false;
+        return true;
+    }
 };
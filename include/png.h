@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes 8-bit RGBA images as PNG files, without a library. Each row is filtered with the Sub
+// filter (the difference to the pixel on the left), which turns flat areas into runs of zeros,
+// and deflated with LZ77 matches and the fixed Huffman codes. The match search is not as
+// thorough as zlib's, but rendered frames, mostly background, still shrink to a small fraction of
+// the raw pixels.
+class PngWriter
+{
+public:
+
+    // pixels: height rows of width RGBA pixels, pitch bytes apart
+    static bool write(const std::string& filename, const uint8_t* pixels, int width, int height, int pitch) {
+        std::vector<uint8_t> png;
+        encode(pixels, width, height, pitch, png);
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(png.data()), png.size());
+        return file.good();
+    }
+
+    static void encode(const uint8_t* pixels, int width, int height, int pitch, std::vector<uint8_t>& png) {
+        png.assign({0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'});
+
+        std::vector<uint8_t> header;
+        put32(header, width);
+        put32(header, height);
+        header.insert(header.end(), {8, 6, 0, 0, 0});     // 8 bits, RGBA, deflate, adaptive filters, no interlace
+        chunk(png, "IHDR", header);
+
+        // each row starts with its filter type, 1: Sub
+        std::vector<uint8_t> raw;
+        raw.reserve((size_t)height * (width * 4 + 1));
+        for (int y=0;y<height;++y) {
+            raw.push_back(1);
+            const uint8_t* row = pixels + (size_t)y * pitch;
+            raw.insert(raw.end(), row, row + std::min(width, 1) * 4);
+            for (int i=4;i<width*4;++i) {
+                raw.push_back(row[i] - row[i - 4]);
+            }
+        }
+
+        // noise doesn't compress, and the fixed codes make it larger: then stored blocks
+        std::vector<uint8_t> data = {0x78, 0x01};
+        deflate(raw, data);
+        if (data.size() > raw.size() + raw.size() / 65535 * 5 + 7) {
+            data.resize(2);
+            store(raw, data);
+        }
+        put32(data, adler32(raw));
+        chunk(png, "IDAT", data);
+
+        chunk(png, "IEND", {});
+    }
+
+private:
+
+    static constexpr int window_size = 32768;
+    static constexpr int min_match = 3;
+    static constexpr int max_match = 258;
+    static constexpr int max_chain = 16;        // earlier positions with the same hash that are tried
+    static constexpr int hash_bits = 15;
+
+    // deflate bits are packed from the least significant bit of each byte on
+    struct BitWriter {
+        std::vector<uint8_t>& out;
+        uint32_t bits = 0;
+        int count = 0;
+
+        void put(uint32_t value, int n) {
+            bits |= value << count;
+            count += n;
+            while (count >= 8) {
+                out.push_back(bits & 0xff);
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes are packed from their most significant bit on
+        void put_code(uint32_t code, int n) {
+            uint32_t reversed = 0;
+            for (int i=0;i<n;++i) {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            put(reversed, n);
+        }
+
+        void flush() {
+            if (count > 0) out.push_back(bits & 0xff);
+            bits = 0;
+            count = 0;
+        }
+    };
+
+    // a literal byte, or a length code (257..285), with the fixed Huffman codes
+    static void put_symbol(BitWriter& writer, int symbol) {
+        if (symbol < 144) writer.put_code(0x30 + symbol, 8);
+        else if (symbol < 256) writer.put_code(0x190 + symbol - 144, 9);
+        else if (symbol < 280) writer.put_code(symbol - 256, 7);
+        else writer.put_code(0xc0 + symbol - 280, 8);
+    }
+
+    static void put_match(BitWriter& writer, int length, int distance) {
+        static constexpr uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static constexpr uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static constexpr uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static constexpr uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        int code = 28;
+        while (length_base[code] > length) code--;
+        put_symbol(writer, 257 + code);
+        writer.put(length - length_base[code], length_extra[code]);
+        code = 29;
+        while (distance_base[code] > distance) code--;
+        writer.put_code(code, 5);
+        writer.put(distance - distance_base[code], distance_extra[code]);
+    }
+
+    // stored blocks of at most 65535 bytes
+    static void store(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out) {
+        size_t offset = 0;
+        do {
+            size_t size = std::min<size_t>(raw.size() - offset, 65535);
+            bool last = offset + size == raw.size();
+            out.push_back(last ? 1 : 0);
+            out.push_back(size & 0xff);
+            out.push_back(size >> 8);
+            out.push_back(~size & 0xff);
+            out.push_back((~size >> 8) & 0xff);
+            out.insert(out.end(), raw.begin() + offset, raw.begin() + offset + size);
+            offset += size;
+        } while (offset < raw.size());
+    }
+
+    // one fixed-Huffman block, with greedy matches found through hash chains of 3-byte prefixes
+    static void deflate(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out) {
+        BitWriter writer {out};
+        writer.put(1, 1);       // last block
+        writer.put(1, 2);       // fixed Huffman codes
+
+        std::vector<int> head(1 << hash_bits, -1);
+        std::vector<int> previous(window_size, -1);
+        auto hash = [&](size_t i) {
+            uint32_t prefix = raw[i] | raw[i + 1] << 8 | raw[i + 2] << 16;
+            return (prefix * 2654435761u) >> (32 - hash_bits);
+        };
+        auto insert = [&](size_t i) {
+            if (i + min_match > raw.size()) return;
+            uint32_t h = hash(i);
+            previous[i % window_size] = head[h];
+            head[h] = i;
+        };
+
+        size_t i = 0;
+        while (i < raw.size()) {
+            int best_length = 0;
+            int best_distance = 0;
+            if (i + min_match <= raw.size()) {
+                int limit = std::min<size_t>(max_match, raw.size() - i);
+                int candidate = head[hash(i)];
+                for (int chain=0;chain<max_chain && candidate >= 0 && i - candidate <= window_size;++chain) {
+                    int length = 0;
+                    while (length < limit && raw[candidate + length] == raw[i + length]) length++;
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = i - candidate;
+                        if (length == limit) break;
+                    }
+                    int next = previous[candidate % window_size];
+                    if (next >= candidate) break;       // overwritten by a later position
+                    candidate = next;
+                }
+            }
+            if (best_length >= min_match) {
+                put_match(writer, best_length, best_distance);
+                for (int k=0;k<best_length;++k) insert(i + k);
+                i += best_length;
+            }
+            else {
+                put_symbol(writer, raw[i]);
+                insert(i);
+                i++;
+            }
+        }
+        put_symbol(writer, 256);        // end of block
+        writer.flush();
+    }
+
+    static void put32(std::vector<uint8_t>& out, uint32_t value) {
+        out.insert(out.end(), {uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value)});
+    }
+
+    static void chunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data) {
+        put32(png, data.size());
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        put32(png, crc32(png.data() + start, png.size() - start));
+    }
+
+    static uint32_t crc32(const uint8_t* data, size_t size) {
+        static const std::array<uint32_t,256> table = [] {
+            std::array<uint32_t,256> table;
+            for (uint32_t n=0;n<256;++n) {
+                uint32_t c = n;
+                for (int k=0;k<8;++k) {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                table[n] = c;
+            }
+            return table;
+        }();
+        uint32_t crc = 0xffffffffu;
+        for (size_t i=0;i<size;++i) {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc ^ 0xffffffffu;
+    }
+
+    static uint32_t adler32(const std::vector<uint8_t>& data) {
+        uint32_t a = 1;
+        uint32_t b = 0;
+        // sums are reduced every 5552 bytes, the most that can't overflow
+        for (size_t start=0;start<data.size();start+=5552) {
+            size_t end = std::min(data.size(), start + 5552);
+            for (size_t i=start;i<end;++i) {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Memory for many objects of one size, allocated in chunks and recycled through a free list,
+// so that allocating and freeing are O(1) and don't go to the heap once the pool has grown.
+// Used through PoolAllocator, e.g. with std::allocate_shared.
+class NodePool
+{
+public:
+    static constexpr int nodes_per_chunk = 1024;
+
+    NodePool() = default;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool() {
+        for (void* chunk: chunks) {
+            ::operator delete(chunk, std::align_val_t(alignof(std::max_align_t)));
+        }
+    }
+
+    void* allocate(size_t size) {
+        // the node size is that of the first allocation; a shared_ptr control block with its object
+        if (node_size == 0) node_size = round_up(std::max(size, sizeof(Node)));
+        assert(size <= node_size);
+        if (!free_list) grow();
+        Node* node = free_list;
+        free_list = node->next;
+        num_allocated++;
+        return node;
+    }
+
+    void deallocate(void* pointer) {
+        Node* node = static_cast<Node*>(pointer);
+        node->next = free_list;
+        free_list = node;
+        num_allocated--;
+    }
+
+    int size() const { return num_allocated; }
+    int capacity() const { return chunks.size() * nodes_per_chunk; }
+    size_t bytes() const { return (size_t)num_allocated * node_size; }     // of the allocated nodes
+
+private:
+
+    struct Node {
+        Node* next;
+    };
+
+    static size_t round_up(size_t size) {
+        size_t align = alignof(std::max_align_t);
+        return (size + align - 1) / align * align;
+    }
+
+    void grow() {
+        char* chunk = static_cast<char*>(::operator new(node_size * nodes_per_chunk, std::align_val_t(alignof(std::max_align_t))));
+        chunks.push_back(chunk);
+        // in address order, so that atoms allocated one after another are close in memory
+        for (int i=nodes_per_chunk-1;i>=0;--i) {
+            Node* node = reinterpret_cast<Node*>(chunk + i * node_size);
+            node->next = free_list;
+            free_list = node;
+        }
+    }
+
+    size_t node_size = 0;
+    Node* free_list = nullptr;
+    std::vector<void*> chunks;
+    int num_allocated = 0;
+};
+
+// Allocator of single objects from a NodePool. Copies share the pool, which lives until
+// the last object allocated from it is freed.
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(std::shared_ptr<NodePool> pool): pool(std::move(pool)) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other): pool(other.pool) {}
+
+    T* allocate(size_t n) {
+        assert(n == 1);
+        return static_cast<T*>(pool->allocate(sizeof(T)));
+    }
+
+    void deallocate(T* pointer, [[maybe_unused]] size_t n) {
+        assert(n == 1);
+        pool->deallocate(pointer);
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+
+    std::shared_ptr<NodePool> pool;
+};
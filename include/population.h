@@ -0,0 +1,239 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "atom.h"
+
+// Number of atoms of each type and state, and of bonds between each pair of types.
+// Kept up to date by World at every change, so reading it is O(1).
+class Population
+{
+public:
+
+    void clear() {
+        atom_counts.assign(num_types * num_states, 0);
+        type_counts.assign(num_types, 0);
+        bond_counts.assign(num_bond_types(), 0);
+    }
+
+    void add_atom(const Atom& atom) {
+        count(atom.type(), atom.state())++;
+        type_counts[atom.type()]++;
+    }
+
+    void remove_atom(const Atom& atom) {
+        count(atom.type(), atom.state())--;
+        type_counts[atom.type()]--;
+    }
+
+    void change_state(const Atom& atom, int new_state) {
+        count(atom.type(), atom.state())--;
+        count(atom.type(), new_state)++;
+    }
+
+    void add_bond(const Atom& atom1, const Atom& atom2) {
+        bond_counts[bond_type(atom1.type(), atom2.type())]++;
+    }
+
+    void remove_bond(const Atom& atom1, const Atom& atom2) {
+        bond_counts[bond_type(atom1.type(), atom2.type())]--;
+    }
+
+    int atoms(int type, int state) const {
+        if (type >= num_types || state >= num_states) return 0;
+        return atom_counts[type * num_states + state];
+    }
+
+    int atoms(int type) const {
+        return (type < num_types) ? type_counts[type] : 0;
+    }
+
+    int bonds(int type1, int type2) const {
+        int index = bond_type(type1, type2);
+        return (index < bond_counts.size()) ? bond_counts[index] : 0;
+    }
+
+    int num_bond_types() const {
+        return num_types * (num_types+1) / 2;
+    }
+
+    // index of an unordered pair of types: aa, ab, bb, ac, bc, cc, ...; the pairs of the first
+    // n types come first, so the index doesn't change when there are more types
+    static int bond_type(int type1, int type2) {
+        int i = std::min(type1, type2);
+        int j = std::max(type1, type2);
+        return j * (j+1) / 2 + i;
+    }
+
+    static std::string bond_type_name(int bond_type) {
+        int j = 0;
+        while ((j+1) * (j+2) / 2 <= bond_type) j++;
+        return type_name(bond_type - j * (j+1) / 2) + type_name(j);
+    }
+
+    int num_types = 6;          // grows when an atom of a higher type is added
+    int num_states = 10;        // grows when a rule sets a higher state
+    std::vector<int> atom_counts = std::vector<int>(num_types * num_states, 0);   // per type, then state
+    std::vector<int> type_counts = std::vector<int>(num_types, 0);
+    std::vector<int> bond_counts = std::vector<int>(num_bond_types(), 0);
+
+private:
+
+    int& count(int type, int state) {
+        if (type >= num_types || state >= num_states) grow(std::max(num_types, type + 1), std::max(num_states, state + 1));
+        return atom_counts[type * num_states + state];
+    }
+
+    void grow(int new_num_types, int new_num_states) {
+        std::vector<int> counts(new_num_types * new_num_states, 0);
+        for (int type=0;type<num_types;++type) {
+            std::copy_n(&atom_counts[type * num_states], num_states, &counts[type * new_num_states]);
+        }
+        atom_counts = std::move(counts);
+        num_types = new_num_types;
+        num_states = new_num_states;
+        type_counts.resize(num_types, 0);
+        bond_counts.resize(num_bond_types(), 0);
+    }
+};
+
+// Samples of the population at a fixed interval of steps: the last capacity samples are
+// kept for plotting, and all of them can be streamed to a CSV or binary file as they are taken.
+class PopulationHistory
+{
+public:
+
+    // one sample: step, atoms per type and state, atoms per type, bonds per bond type
+    struct Sample {
+        int step = 0;
+        int num_types = 0;
+        int num_states = 0;
+        std::vector<int> values;
+    };
+
+    void clear() {
+        written = 0;
+    }
+
+    void sample(int step, const Population& population) {
+        if (samples.size() < capacity) samples.emplace_back();
+        Sample& sample = samples[written % capacity];
+        written++;
+        sample.step = step;
+        sample.num_types = population.num_types;
+        sample.num_states = population.num_states;
+        sample.values.assign(population.atom_counts.begin(), population.atom_counts.end());
+        sample.values.insert(sample.values.end(), population.type_counts.begin(), population.type_counts.end());
+        sample.values.insert(sample.values.end(), population.bond_counts.begin(), population.bond_counts.end());
+        if (file.is_open()) write_sample(sample);
+    }
+
+    // number of samples kept
+    int size() const {
+        return std::min<long>(written, capacity);
+    }
+
+    // i-th kept sample, oldest first
+    const Sample& at(int i) const {
+        return samples[(written - size() + i) % capacity];
+    }
+
+    // atoms of one type (and state, if state >= 0) over the kept samples, oldest first
+    void atom_series(int type, int state, std::vector<float>& out) const {
+        out.resize(size());
+        for (int i=0;i<out.size();++i) {
+            const Sample& s = at(i);
+            if (type >= s.num_types) out[i] = 0;
+            else if (state < 0) out[i] = s.values[s.num_types * s.num_states + type];
+            else out[i] = (state < s.num_states) ? s.values[type * s.num_states + state] : 0;
+        }
+    }
+
+    void bond_series(int bond_type, std::vector<float>& out) const {
+        out.resize(size());
+        for (int i=0;i<out.size();++i) {
+            const Sample& s = at(i);
+            int offset = s.num_types * (s.num_states + 1);
+            out[i] = (offset + bond_type < s.values.size()) ? s.values[offset + bond_type] : 0;
+        }
+    }
+
+    // Stream the samples from now on to a file: CSV, or raw int32 rows if the name ends in .bin.
+    // Either starts with a line of column names, with num_types types and num_states states per type.
+    bool open(const std::string& filename, int num_types, int num_states) {
+        binary = filename.ends_with(".bin");
+        file.open(filename, binary ? std::ios::binary : std::ios::out);
+        if (!file) return false;
+        file_num_types = num_types;
+        file_num_states = num_states;
+        std::string header = "step";
+        for (int type=0;type<num_types;++type) {
+            for (int state=0;state<num_states;++state) {
+                header += "," + type_name(type) + std::to_string(state);
+            }
+        }
+        for (int type=0;type<num_types;++type) {
+            header += "," + type_name(type);
+        }
+        for (int bond_type=0;bond_type<num_types*(num_types+1)/2;++bond_type) {
+            header += ",bond_" + Population::bond_type_name(bond_type);
+        }
+        file << header << "\n";
+        return true;
+    }
+
+    void close() {
+        file.close();
+    }
+
+    int capacity = 1024;
+
+private:
+
+    // higher types than the file has columns for are left out
+    void write_sample(const Sample& sample) {
+        row.clear();
+        row.push_back(sample.step);
+        for (int type=0;type<file_num_types;++type) {
+            for (int state=0;state<file_num_states;++state) {
+                // higher states than the file has columns for are added to the last column
+                int end = (state == file_num_states-1) ? sample.num_states : std::min(state+1, sample.num_states);
+                int value = 0;
+                for (int s=state;s<end && type<sample.num_types;++s) {
+                    value += sample.values[type * sample.num_states + s];
+                }
+                row.push_back(value);
+            }
+        }
+        int offset = sample.num_types * sample.num_states;
+        for (int type=0;type<file_num_types;++type) {
+            row.push_back(type < sample.num_types ? sample.values[offset + type] : 0);
+        }
+        offset += sample.num_types;
+        for (int bond_type=0;bond_type<file_num_types*(file_num_types+1)/2;++bond_type) {
+            row.push_back(offset + bond_type < sample.values.size() ? sample.values[offset + bond_type] : 0);
+        }
+        if (binary) {
+            file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(int32_t));
+        }
+        else {
+            for (int i=0;i<row.size();++i) {
+                file << (i ? "," : "") << row[i];
+            }
+            file << "\n";
+        }
+    }
+
+    std::vector<Sample> samples;    // ring buffer
+    long written = 0;               // number of samples taken
+    std::ofstream file;
+    bool binary = false;
+    int file_num_types = 0;
+    int file_num_states = 0;
+    std::vector<int32_t> row;
+};
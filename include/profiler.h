@@ -0,0 +1,176 @@
+#pragma once
+
+// Per-phase profiler for the hot paths of the simulation and drawing.
+//
+// Enable by compiling with -DPROFILER (see PROFILEFLAGS in the Makefile).
+// Without it, the PROFILE_* macros compile to nothing and there is no Profiler class.
+//
+// Each frame, the duration of each phase is summed and stored in a ring buffer
+// of the last num_frames frames, together with the individual phase events for
+// export as a Chrome trace (chrome://tracing or https://ui.perfetto.dev).
+
+enum class Phase {
+    pairs,              // SpaceMap::get_pairs
+    rule_match,         // rule loop, excluding rule_apply
+    rule_apply,
+    bond_break,
+    bond_force,
+    collision,
+    integration,        // moving atoms and updating the spacemap
+    housekeeping,       // reordering and sleeping
+    imgui,
+    render,
+    count
+};
+
+inline const char* phase_names[] = {
+    "pairs", "rule match", "rule apply", "bond break", "bond force",
+    "collision", "integration", "housekeeping", "imgui", "render"
+};
+
+#ifdef PROFILER
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int num_phases = static_cast<int>(Phase::count);
+    static constexpr int num_frames = 256;
+    static constexpr int max_events_per_frame = 4096;
+
+    struct Event {
+        Phase phase;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+    struct Frame {
+        Clock::time_point start;
+        Clock::time_point end;
+        std::array<float,num_phases> durations_ms {};
+        std::vector<Event> events;     // only phases that are traced
+    };
+
+    // Times a scope and adds it to the current frame.
+    class Scope {
+    public:
+        Scope(Profiler& profiler, Phase phase, bool traced = true)
+            :profiler(profiler), phase(phase), traced(traced), start(Clock::now()) {}
+        ~Scope() { profiler.add(phase, start, Clock::now(), traced); }
+    private:
+        Profiler& profiler;
+        Phase phase;
+        bool traced;
+        Clock::time_point start;
+    };
+
+    Profiler(): epoch(Clock::now()) {
+        for (auto& frame: frames) {
+            frame.events.reserve(max_events_per_frame);
+        }
+    }
+
+    void begin_frame() {
+        Frame& frame = frames[written % num_frames];
+        frame.start = Clock::now();
+        frame.durations_ms.fill(0);
+        frame.events.clear();
+    }
+
+    void end_frame() {
+        Frame& frame = frames[written % num_frames];
+        frame.end = Clock::now();
+        // rule_apply is timed inside the rule_match scope
+        frame.durations_ms[static_cast<int>(Phase::rule_match)] -= frame.durations_ms[static_cast<int>(Phase::rule_apply)];
+        written.store(written + 1, std::memory_order_release);
+    }
+
+    void add(Phase phase, Clock::time_point start, Clock::time_point end, bool traced) {
+        Frame& frame = frames[written % num_frames];
+        std::chrono::duration<float, std::milli> duration = end - start;
+        frame.durations_ms[static_cast<int>(phase)] += duration.count();
+        if (traced && frame.events.size() < max_events_per_frame) {
+            frame.events.push_back({phase, start, end});
+        }
+    }
+
+    // number of completed frames in the buffer; the slot of the frame being written is not one of
+    // them, so at most num_frames - 1
+    int size() const {
+        return size(written.load(std::memory_order_acquire));
+    }
+
+    // i-th completed frame, oldest first
+    const Frame& frame(int i) const {
+        uint64_t n = written.load(std::memory_order_acquire);
+        return frames[(n - size(n) + i) % num_frames];
+    }
+
+    // durations of one phase over the completed frames, oldest first
+    void history(Phase phase, std::vector<float>& out) const {
+        out.resize(size());
+        for (int i=0;i<out.size();++i) {
+            out[i] = frame(i).durations_ms[static_cast<int>(phase)];
+        }
+    }
+
+    bool export_chrome_trace(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file) return false;
+        auto micros = [&](Clock::time_point t) {
+            return std::chrono::duration<double, std::micro>(t - epoch).count();
+        };
+        file << "{\"traceEvents\":[\n";
+        bool first = true;
+        auto write_event = [&](const char* name, Clock::time_point start, Clock::time_point end, int tid) {
+            file << (first ? "" : ",\n")
+                 << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                 << ",\"ts\":" << micros(start) << ",\"dur\":" << micros(end) - micros(start) << "}";
+            first = false;
+        };
+        for (int i=0;i<size();++i) {
+            const Frame& f = frame(i);
+            write_event("frame", f.start, f.end, 1);
+            for (auto& event: f.events) {
+                write_event(phase_names[static_cast<int>(event.phase)], event.start, event.end, 2);
+            }
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return true;
+    }
+
+private:
+
+    static int size(uint64_t written) {
+        return std::min<uint64_t>(written, num_frames - 1);
+    }
+
+    Clock::time_point epoch;
+    std::array<Frame,num_frames> frames;
+    std::atomic<uint64_t> written = 0;     // number of frames written; only the simulation thread writes
+};
+
+#define PROFILE_CONCAT_(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_(a,b)
+// time the enclosing scope as a phase
+#define PROFILE_SCOPE(profiler, phase) Profiler::Scope PROFILE_CONCAT(profile_scope_,__LINE__)(profiler, phase)
+// time the enclosing scope, but leave it out of the trace; for short, frequent scopes
+#define PROFILE_SCOPE_UNTRACED(profiler, phase) Profiler::Scope PROFILE_CONCAT(profile_scope_,__LINE__)(profiler, phase, false)
+#define PROFILE_BEGIN_FRAME(profiler) (profiler).begin_frame()
+#define PROFILE_END_FRAME(profiler) (profiler).end_frame()
+
+#else
+
+#define PROFILE_SCOPE(profiler, phase)
+#define PROFILE_SCOPE_UNTRACED(profiler, phase)
+#define PROFILE_BEGIN_FRAME(profiler)
+#define PROFILE_END_FRAME(profiler)
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cctype>
+#include <optional>
+#include <sstream>
+#include <string>
+
+#include "atom.h"
+
+// A rectangle of the world that continuously emits new atoms (a source)
+// or removes the atoms in it (a sink), for open-system experiments.
+struct Region
+{
+    enum class Kind { emitter, absorber };
+
+    Kind kind = Kind::emitter;
+    float x = 0;
+    float y = 0;
+    float width = 100;
+    float height = 100;
+    static constexpr int any_type = -1;     // written '*'
+
+    int type = 0;           // of emitted atoms; absorbers take atoms of this type, or any if any_type
+    int state = 0;          // of emitted atoms
+    float rate = 0.1f;      // emitted atoms per step
+
+    float emit_credit = 0;  // fraction of an atom owed by the emitter
+    long count = 0;         // atoms emitted or absorbed so far
+
+    bool contains(float px, float py) const {
+        return px >= x && px <= x + width && py >= y && py <= y + height;
+    }
+
+    bool accepts(const Atom& atom) const {
+        return type == any_type || atom.type() == type;
+    }
+
+    // e.g. "emit a0 100 100 50 50 0.5" or "absorb * 1500 0 100 900"
+    std::string toText() const {
+        std::ostringstream text;
+        if (kind == Kind::emitter) {
+            text << "emit " << type_name(type) << state << " " << x << " " << y << " " << width << " " << height << " " << rate;
+        }
+        else {
+            text << "absorb " << (type == any_type ? "*" : type_name(type)) << " " << x << " " << y << " " << width << " " << height;
+        }
+        return text.str();
+    }
+
+    static std::optional<Region> fromText(const std::string& text) {
+        std::istringstream in(text);
+        std::string kind, atom;
+        Region region;
+        if (!(in >> kind >> atom) || atom.empty()) return std::nullopt;
+        size_t i = 0;
+        region.type = (atom == "*") ? any_type : parse_type(atom, i);
+        if (kind == "emit") {
+            region.kind = Kind::emitter;
+            if (region.type < 0 || i == atom.size()) return std::nullopt;
+            try { region.state = std::stoi(atom.substr(i)); } catch (...) { return std::nullopt; }
+            if (region.state < 0 || region.state >= max_states) return std::nullopt;
+            if (!(in >> region.x >> region.y >> region.width >> region.height >> region.rate)) return std::nullopt;
+        }
+        else if (kind == "absorb") {
+            region.kind = Kind::absorber;
+            if (region.type != any_type && (region.type < 0 || i != atom.size())) return std::nullopt;
+            if (!(in >> region.x >> region.y >> region.width >> region.height)) return std::nullopt;
+        }
+        else {
+            return std::nullopt;
+        }
+        return region;
+    }
+};
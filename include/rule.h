@@ -1,22 +1,53 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <format>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "atom.h"
+
+// Statistics of a rule, collected by World::step()
+struct RuleStats 
+{
+    double attempts = 0;    // pairs tested, estimated from sampled pairs
+    long hits = 0;          // pairs the rule matched and was applied to
+    long blocked = 0;       // hits where no bond was made because of max_bonds_per_atom
+    double time = 0;        // seconds spent on the rule, estimated from sampled pairs
+};
+
 struct Rule 
 {
+    // types that match any type; both X in a rule are the same type, as are both Y
+    static constexpr int type_x = -1;
+    static constexpr int type_y = -2;
 
-    char atom_type1;
+    int atom_type1;
     int before_state1;
     
     bool before_bonded;
     
-    char atom_type2;
+    int atom_type2;
     int before_state2;
     
     int after_state1;
     bool after_bonded;
     int after_state2;
 
-    Rule(char atom_type1, int before_state1, bool before_linked,
-         char atom_type2, int before_state2,
+    // how often the rule fires on a pair it matches: with World::stochastic_rules, the expected
+    // number of times per step, else the probability per step (1 or more: always)
+    float rate = 1;
+
+    RuleStats stats;
+
+    Rule(int atom_type1, int before_state1, bool before_linked,
+         int atom_type2, int before_state2,
          int after_state1, bool after_linked, int after_state2)
         :atom_type1(atom_type1), before_state1(before_state1), before_bonded(before_linked),
          atom_type2(atom_type2), before_state2(before_state2),
@@ -25,63 +56,173 @@ struct Rule
         
     };
 
+    static std::string type_text(int type) {
+        if (type == type_x) return "X";
+        if (type == type_y) return "Y";
+        return type_name(type);
+    }
+
+    // the rate only if it isn't 1, e.g. "a0+b0->a1b1@0.5"
     std::string toText() const {
-        return std::format("{}{}{}{}{}->{}{}{}{}{}",
-            atom_type1,
+        std::string rate_text = (rate != 1) ? std::format("@{}", rate) : "";
+        return std::format("{}{}{}{}{}->{}{}{}{}{}{}",
+            type_text(atom_type1),
             before_state1,
             before_bonded?"":"+",
-            atom_type2,
+            type_text(atom_type2),
             before_state2,
-            atom_type1,
+            type_text(atom_type1),
             after_state1,
             after_bonded?"":"+",
-            atom_type2,
-            after_state2
+            type_text(atom_type2),
+            after_state2,
+            rate_text
         );
     }
 
-    bool match(const std::shared_ptr<const Atom>& atom1, const std::shared_ptr<const Atom>& atom2, bool bonded) const
-    {
-        char match_x = 0;
-        char match_y = 0;
-
-        if (atom_type1 == 'X') {
-            if (match_x == 0 || match_x == atom1->type)
-                match_x = atom1->type;
-            else {
-                return false;
-            }
+    // parses the format of toText(), e.g. "a0+b0->a1b1" or "a0+b0->a1b1@0.5"
+    static std::optional<Rule> fromText(const std::string& text) {
+        std::string s;
+        for (char c: text) {
+            if (!std::isspace(c)) s += c;
         }
-        else if (atom_type1 == 'Y') {
-            if (match_y == 0 || match_y == atom1->type)
-                match_y = atom1->type;
-            else {
-                return false;
+        size_t i = 0;
+        auto type = [&](int& t) {
+            if (i < s.size() && s[i] == 'X') { i++; t = type_x; return true; }
+            if (i < s.size() && s[i] == 'Y') { i++; t = type_y; return true; }
+            t = parse_type(s, i);
+            return t >= 0;
+        };
+        auto state = [&](int& st) {
+            size_t start = i;
+            while (i < s.size() && std::isdigit(s[i])) i++;
+            if (i == start || i - start > 3) return false;
+            st = std::stoi(s.substr(start, i-start));
+            return st < max_states;
+        };
+        auto unbonded = [&]() {
+            if (i < s.size() && s[i] == '+') { i++; return true; }
+            return false;
+        };
+        int type1, type2, after_type1, after_type2;
+        int before1, before2, after1, after2;
+        if (!type(type1) || !state(before1)) return std::nullopt;
+        bool before_bonded = !unbonded();
+        if (!type(type2) || !state(before2)) return std::nullopt;
+        if (s.compare(i, 2, "->") != 0) return std::nullopt;
+        i += 2;
+        if (!type(after_type1) || !state(after1)) return std::nullopt;
+        bool after_bonded = !unbonded();
+        if (!type(after_type2) || !state(after2)) return std::nullopt;
+        float rate = 1;
+        if (i < s.size() && s[i] == '@') {
+            i++;
+            size_t length = 0;
+            try {
+                rate = std::stof(s.substr(i), &length);
             }
-        }
-        else {
-             if (atom1->type != atom_type1) return false;
-        }
-        if (atom_type2 == 'X') {
-            if (match_x == 0 || match_x == atom2->type)
-                match_x = atom2->type;
-            else {
-                return false;
-            }
-        }
-        else if (atom_type2 == 'Y') {
-            if (match_y == 0 || match_y == atom2->type)
-                match_y = atom2->type;
-            else {
-                return false;
+            catch (const std::exception&) {
+                return std::nullopt;
             }
+            if (!std::isfinite(rate) || rate < 0) return std::nullopt;
+            i += length;
         }
-        else {
-              if (atom2->type != atom_type2) return false;
-        }
-        if (atom1->state != before_state1 || atom2->state != before_state2) return false;
+        if (i != s.size() || after_type1 != type1 || after_type2 != type2) return std::nullopt;
+        Rule rule(type1, before1, before_bonded, type2, before2, after1, after_bonded, after2);
+        rule.rate = rate;
+        return rule;
+    }
+
+    // whether an atom with this key can be the first atom of a match
+    bool matches_first(AtomKey key) const {
+        return (atom_type1 < 0 || atom_type1 == key_type(key)) && before_state1 == key_state(key);
+    }
+
+    bool match(const std::shared_ptr<const Atom>& atom1, const std::shared_ptr<const Atom>& atom2, bool bonded) const
+    {
+        return match(atom1->key, atom2->key, bonded);
+    };
+
+    bool match(AtomKey key1, AtomKey key2, bool bonded) const
+    {
+        int type1 = key_type(key1);
+        int type2 = key_type(key2);
+        if (atom_type1 >= 0 && atom_type1 != type1) return false;
+        if (atom_type2 >= 0 && atom_type2 != type2) return false;
+        // the same wildcard twice is the same type
+        if (atom_type1 < 0 && atom_type1 == atom_type2 && type1 != type2) return false;
+        if (key_state(key1) != before_state1 || key_state(key2) != before_state2) return false;
         if (bonded != before_bonded) return false;
         return true;
-    };
+    }
     
-};
\ No newline at end of file
+};
+
+// The rules that can match an atom with a given key as first atom, by key, in rule order.
+// For a pair, only the rules of the keys of its two atoms are tried, so the time to match a pair
+// depends on the number of rules that apply to its atoms, not on the number of rules, types and
+// states. Rebuilt when the rules change, which update() finds out by comparing the match
+// conditions, the only part of the rules the table depends on.
+class RuleTable
+{
+public:
+
+    void update(const std::vector<std::unique_ptr<Rule>>& rules) {
+        bool changed = start.empty() || conditions.size() != rules.size();
+        for (int r=0;r<rules.size() && !changed;++r) {
+            changed = conditions[r] != condition(*rules[r]);
+        }
+        if (changed) build(rules);
+    }
+
+    // the index of the first rule after the given one that can match the pair of keys, in
+    // either order; -1 if there is none
+    int next(AtomKey key1, AtomKey key2, int after) const {
+        int next1 = first_after(key1, after);
+        int next2 = first_after(key2, after);
+        if (next1 < 0) return next2;
+        if (next2 < 0) return next1;
+        return std::min(next1, next2);
+    }
+
+private:
+
+    using Condition = std::array<int,2>;        // first type and state
+
+    static Condition condition(const Rule& rule) {
+        return {rule.atom_type1, rule.before_state1};
+    }
+
+    void build(const std::vector<std::unique_ptr<Rule>>& rules) {
+        conditions.clear();
+        // counting sort of (key, rule) by key; a wildcard rule is listed under every type
+        start.assign(num_keys + 1, 0);
+        auto for_each_key = [&](const Rule& rule, auto f) {
+            if (rule.atom_type1 >= 0) f(atom_key(rule.atom_type1, rule.before_state1));
+            else for (int type=0;type<max_types;++type) f(atom_key(type, rule.before_state1));
+        };
+        for (auto& rule: rules) {
+            conditions.push_back(condition(*rule));
+            for_each_key(*rule, [&](AtomKey key) { start[key + 1]++; });
+        }
+        for (int key=0;key<num_keys;++key) {
+            start[key + 1] += start[key];
+        }
+        indices.resize(start[num_keys]);
+        std::vector<int> next = start;
+        for (int r=0;r<rules.size();++r) {
+            for_each_key(*rules[r], [&](AtomKey key) { indices[next[key]++] = r; });
+        }
+    }
+
+    int first_after(AtomKey key, int after) const {
+        auto begin = indices.begin() + start[key];
+        auto end = indices.begin() + start[key + 1];
+        auto it = std::upper_bound(begin, end, after);
+        return it == end ? -1 : *it;
+    }
+
+    std::vector<Condition> conditions;      // of the rules the table was built for
+    std::vector<int> start;                 // the rules of key k are indices[start[k]] up to indices[start[k+1]]
+    std::vector<int> indices;
+};
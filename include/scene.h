@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "atomrenderer.h"
+#include "region.h"
+#include "world.h"
+
+// What is drawn of a world: a copy of the positions of the atoms, bonds and regions, so that
+// it can be drawn on another thread while the world goes on, see FrameExporter.
+struct Scene
+{
+    struct AtomView {
+        float x;
+        float y;
+        AtomKey key;
+    };
+
+    struct BondView {
+        float x1;
+        float y1;
+        float x2;
+        float y2;
+    };
+
+    void capture(const World& world) {
+        step = world.step_count;
+        width = world.params.space_width;
+        height = world.params.space_height;
+        atoms.clear();
+        for (auto& atom: world.atoms) {
+            atoms.push_back({atom->x, atom->y, atom->key});
+        }
+        bonds.clear();
+        for (auto& bond: world.bonds) {
+            BondView view;
+            bond->line(view.x1, view.y1, view.x2, view.y2);
+            bonds.push_back(view);
+        }
+        regions = world.regions;
+    }
+
+    // onto a target of target_width x target_height pixels, with the world at the given scale and offset
+    void draw(SDL_Renderer& renderer, AtomRenderer& atom_renderer, float target_width, float target_height,
+              float scale, float offset_x, float offset_y) const {
+        SDL_SetRenderDrawColor(&renderer, 64,64,64,255);
+        SDL_FRect target_rect = {0, 0, target_width, target_height};
+        SDL_RenderFillRectF(&renderer, &target_rect);
+        SDL_SetRenderDrawColor(&renderer, 0,0,0,255);
+        SDL_FRect space_rect = {offset_x, offset_y, width*scale, height*scale};
+        SDL_RenderFillRectF(&renderer, &space_rect);
+
+        for (auto& atom: atoms) {
+            atom_renderer.draw(atom.key, atom.x, atom.y, scale, offset_x, offset_y);
+        }
+
+        SDL_SetRenderDrawColor(&renderer, 255, 255, 255, 255);
+        for (auto& bond: bonds) {
+            SDL_RenderDrawLineF(&renderer, offset_x + bond.x1*scale, offset_y + bond.y1*scale,
+                                           offset_x + bond.x2*scale, offset_y + bond.y2*scale);
+        }
+
+        for (auto& region: regions) {
+            if (region.kind == Region::Kind::emitter) SDL_SetRenderDrawColor(&renderer, 0, 160, 0, 255);
+            else SDL_SetRenderDrawColor(&renderer, 160, 0, 0, 255);
+            SDL_FRect rect = {offset_x + region.x*scale, offset_y + region.y*scale, region.width*scale, region.height*scale};
+            SDL_RenderDrawRectF(&renderer, &rect);
+        }
+    }
+
+    int step = 0;
+    float width = 0;
+    float height = 0;
+    std::vector<AtomView> atoms;
+    std::vector<BondView> bonds;
+    std::vector<Region> regions;
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "atomkey.h"
+#include "physicsparameters.h"
+#include "util.h"
+
+// How the atoms of a restart are placed, see World::restart()
+enum class StartLayout {
+    random,     // anywhere, one at a time; atoms may overlap
+    grid,       // without overlap, see Seeder
+};
+
+// Molecules that a world can start with: copies of a chain or ring of atoms, written e.g.
+//   chain a0b0c0 50        50 chains of an a, a b and a c atom
+//   ring [30]1a0a0a0 10    10 rings of 4 atoms
+// The atoms are laid out a bond length apart, a chain in a row, a ring in two rows (along the top
+// row and back along the bottom one), each bonded to the next.
+struct MoleculeTemplate
+{
+    enum class Shape { chain, ring };
+
+    Shape shape = Shape::chain;
+    std::vector<AtomKey> keys;      // along the chain, or around the ring
+    int count = 1;                  // number of molecules
+
+    int width() const {
+        return shape == Shape::chain ? keys.size() : (keys.size() + 1) / 2;
+    }
+
+    int height() const {
+        return shape == Shape::chain ? 1 : 2;
+    }
+
+    // the column and row of atom i, from the first atom
+    std::pair<int,int> cell(int i) const {
+        if (i < width()) return {i, 0};
+        return {2 * width() - 1 - i, 1};
+    }
+
+    int num_bonds() const {
+        return shape == Shape::chain ? (int)keys.size() - 1 : (int)keys.size();
+    }
+
+    std::string toText() const {
+        std::string text = (shape == Shape::chain) ? "chain " : "ring ";
+        for (AtomKey key: keys) {
+            text += key_name(key);
+        }
+        return text + " " + std::to_string(count);
+    }
+
+    static std::optional<MoleculeTemplate> fromText(const std::string& text) {
+        std::istringstream in(text);
+        std::string shape, atoms;
+        MoleculeTemplate molecule;
+        if (!(in >> shape >> atoms)) return std::nullopt;
+        if (shape == "chain") molecule.shape = Shape::chain;
+        else if (shape == "ring") molecule.shape = Shape::ring;
+        else return std::nullopt;
+        size_t i = 0;
+        while (i < atoms.size()) {
+            int type = parse_type(atoms, i);
+            size_t start = i;
+            while (i < atoms.size() && std::isdigit(atoms[i])) i++;
+            if (type < 0 || i == start || i - start > 3) return std::nullopt;
+            int state = std::stoi(atoms.substr(start, i - start));
+            if (state >= max_states) return std::nullopt;
+            molecule.keys.push_back(atom_key(type, state));
+        }
+        if (!(in >> molecule.count)) molecule.count = 1;
+        if (molecule.count < 0 || molecule.keys.empty()) return std::nullopt;
+        if (molecule.shape == Shape::ring && molecule.keys.size() < 3) return std::nullopt;
+        std::string rest;
+        if (in >> rest) return std::nullopt;
+        return molecule;
+    }
+};
+
+// Places the start atoms without overlap, in time linear in the number of atoms: the space is
+// divided into a grid of square cells, at least an atom diameter wide, with as many cells as
+// atoms if there is room. The molecules are placed first, each where a few random tries find a
+// free rectangle of width() x height() cells; its atoms are a bond length (at most a cell) apart
+// from the centre of the first cell on, so they stay inside it. Then the single atoms go in free
+// cells picked at random, each at a random offset from the centre of its cell that keeps it at
+// least a radius from the cell's edges (a jittered grid).
+//
+// The offsets are drawn on threads, in blocks that each have a random generator of their own
+// seeded from the world's, so the placement doesn't depend on the number of threads.
+class Seeder
+{
+public:
+
+    struct Placement {
+        float x;
+        float y;
+        AtomKey key;
+    };
+
+    std::vector<Placement> atoms;               // the molecules' atoms first
+    std::vector<std::pair<int,int>> bonds;      // indices into atoms
+    int missing_atoms = 0;                      // for which there was no room
+    int missing_molecules = 0;
+    float cell_size = 0;
+
+    // counts: the number of single atoms per type, in state 0
+    void seed(const PhysicsParameters& params, const std::vector<int>& counts,
+              const std::vector<MoleculeTemplate>& molecules, Random& random, int threads = 0) {
+        float width = params.space_width;
+        float height = params.space_height;
+        atoms.clear();
+        bonds.clear();
+        missing_atoms = 0;
+        missing_molecules = 0;
+
+        int num_single = 0;
+        for (int count: counts) num_single += count;
+        int num_molecule_atoms = 0;
+        for (auto& molecule: molecules) num_molecule_atoms += molecule.count * molecule.keys.size();
+        // molecules are placed by trial, so leave them some room
+        int wanted = num_single + num_molecule_atoms + num_molecule_atoms / 4;
+        if (wanted == 0) return;
+
+        float diameter = 2 * params.atom_radius;
+        cell_size = std::max(diameter, std::sqrt(width * height / wanted));
+        int nx, ny;
+        while (true) {
+            nx = std::max(0, (int)(width / cell_size));
+            ny = std::max(0, (int)(height / cell_size));
+            if ((long)nx * ny >= wanted || cell_size <= diameter) break;
+            cell_size = std::max(diameter, cell_size * 0.98f);
+        }
+        // the grid is centred, so the atoms in the outer cells are at least a radius from the edge
+        float margin_x = (width - nx * cell_size) / 2;
+        float margin_y = (height - ny * cell_size) / 2;
+        auto centre = [&](int column, int row) {
+            return std::pair<float,float>(margin_x + (column + 0.5f) * cell_size, margin_y + (row + 0.5f) * cell_size);
+        };
+        float bond_spacing = std::clamp(params.bonding_distance, diameter, cell_size);
+        std::vector<uint8_t> used((size_t)nx * ny, 0);
+
+        for (auto& molecule: molecules) {
+            int w = molecule.width();
+            int h = molecule.height();
+            for (int copy=0;copy<molecule.count;++copy) {
+                bool placed = false;
+                for (int attempt=0;attempt<32 && !placed && w <= nx && h <= ny;++attempt) {
+                    int column = random.below(nx - w + 1);
+                    int row = random.below(ny - h + 1);
+                    bool free = true;
+                    for (int dy=0;dy<h && free;++dy) {
+                        for (int dx=0;dx<w && free;++dx) {
+                            free = !used[(size_t)(row + dy) * nx + column + dx];
+                        }
+                    }
+                    if (!free) continue;
+                    for (int dy=0;dy<h;++dy) {
+                        std::fill_n(&used[(size_t)(row + dy) * nx + column], w, 1);
+                    }
+                    int first = atoms.size();
+                    auto [x0, y0] = centre(column, row);
+                    for (int i=0;i<molecule.keys.size();++i) {
+                        auto [dx, dy] = molecule.cell(i);
+                        atoms.push_back({x0 + dx * bond_spacing, y0 + dy * bond_spacing, molecule.keys[i]});
+                    }
+                    for (int i=0;i<molecule.num_bonds();++i) {
+                        bonds.push_back({first + i, first + (i + 1) % (int)molecule.keys.size()});
+                    }
+                    placed = true;
+                }
+                if (!placed) missing_molecules++;
+            }
+        }
+
+        // a random choice of the free cells (a partial Fisher-Yates shuffle)
+        std::vector<int> free_cells;
+        free_cells.reserve(used.size());
+        for (int cell=0;cell<used.size();++cell) {
+            if (!used[cell]) free_cells.push_back(cell);
+        }
+        int num_placed = std::min<int>(num_single, free_cells.size());
+        missing_atoms = num_single - num_placed;
+        for (int i=0;i<num_placed;++i) {
+            std::swap(free_cells[i], free_cells[i + random.below(free_cells.size() - i)]);
+        }
+
+        // the single atoms by type, in the shuffled cells, so the types are mixed
+        int first = atoms.size();
+        atoms.resize(first + num_placed);
+        int i = first;
+        for (int type=0;type<counts.size();++type) {
+            for (int j=0;j<counts[type] && i<atoms.size();++j) {
+                atoms[i++].key = atom_key(type, 0);
+            }
+        }
+
+        float jitter = (cell_size - diameter) / 2;
+        uint64_t seed = (uint64_t)random.next() << 32 | random.next();
+        int num_blocks = (num_placed + block_size - 1) / block_size;
+        parallel_for(num_blocks, threads, [&](int block) {
+            Random block_random(seed + block * 0x9e3779b97f4a7c15ULL);
+            int end = std::min(num_placed, (block + 1) * block_size);
+            for (int k=block*block_size;k<end;++k) {
+                int cell = free_cells[k];
+                auto [x, y] = centre(cell % nx, cell / nx);
+                auto& atom = atoms[first + k];
+                atom.x = x + block_random.randf(-jitter, jitter);
+                atom.y = y + block_random.randf(-jitter, jitter);
+            }
+        });
+    }
+
+    // f(i) for i in [0, n), on up to the given number of threads (0: all hardware threads)
+    template<typename F>
+    static void parallel_for(int n, int threads, F f) {
+        if (threads <= 0) threads = hardware_threads();
+        threads = std::min(threads, n);
+        if (threads <= 1) {
+            for (int i=0;i<n;++i) f(i);
+            return;
+        }
+        std::vector<std::thread> pool;
+        for (int t=0;t<threads;++t) {
+            pool.emplace_back([&, t]() {
+                for (int i=t;i<n;i+=threads) f(i);
+            });
+        }
+        for (auto& thread: pool) {
+            thread.join();
+        }
+    }
+
+    static int hardware_threads() {
+#ifdef WEBAPP
+        return 1;       // a browser can't start threads while the page's thread waits for them
+#else
+        return std::max(1u, std::thread::hardware_concurrency());
+#endif
+    }
+
+private:
+
+    static constexpr int block_size = 16384;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "boundary.h"
+
+// Kernels for 4 floats at a time, written with the vector extensions of GCC and Clang, so the
+// same code is SSE on x86-64, NEON on ARM and WebAssembly SIMD in the builds with -msimd128
+// (web-mt and node); without a vector unit the compiler splits them into scalar code. They
+// compute exactly what the scalar code computes, so the results don't depend on the build.
+
+typedef float float4 __attribute__((vector_size(16)));
+typedef int32_t int4 __attribute__((vector_size(16)));
+
+inline float4 splat4(float value) {
+    return float4{value, value, value, value};
+}
+
+// unaligned
+inline float4 load4(const float* values) {
+    float4 vector;
+    std::memcpy(&vector, values, sizeof(vector));
+    return vector;
+}
+
+// the lanes of a comparison (all bits set where true) as bits 0-3
+inline unsigned lane_bits(int4 lanes) {
+    return (lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8);
+}
+
+// boundary_delta() of 4 displacements
+template<Boundary B>
+inline float4 boundary_delta4(float4 d, float size) {
+    if constexpr (B == Boundary::periodic) {
+        float4 sizes = splat4(size);
+        int4 above = d > splat4(size * 0.5f);
+        int4 below = d < splat4(-size * 0.5f);
+        // above and below exclude each other; adding or subtracting 0 leaves d as it is
+        d = d - (float4)((int4)sizes & above) + (float4)((int4)sizes & below);
+    }
+    return d;
+}
+
+// bit k is set if point k of xs, ys is closer to (x, y) than sqrt(distance2), as boundary_delta() measures it
+template<Boundary B>
+inline unsigned within4(const float* xs, const float* ys, float x, float y, float xsize, float ysize, float distance2) {
+    float4 dx = boundary_delta4<B>(splat4(x) - load4(xs), xsize);
+    float4 dy = boundary_delta4<B>(splat4(y) - load4(ys), ysize);
+    return lane_bits(dx * dx + dy * dy < splat4(distance2));
+}
@@ -2,8 +2,15 @@
 
 #include <vector>
 #include <memory>
+#include <span>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <iterator>
 
 #include "atom.h"
+#include "simd.h"
+#include "threadpool.h"
 
 struct SpaceMap
 {
@@ -12,6 +19,7 @@ struct SpaceMap
     
     // vars
     std::vector<Cell> cells;
+    std::vector<int> num_awake;     // number of atoms per cell that are not sleeping
     float xsize = 0;
     float ysize = 0; 
     float xstep = 1;
@@ -25,11 +33,13 @@ struct SpaceMap
         nx = static_cast<int>(xsize / xstep);
         ny = static_cast<int>(ysize / ystep);
         cells.resize(nx * ny);
+        num_awake.resize(nx * ny);
     }
 
     int position_to_index(float x, float y) const {
-        int ix = static_cast<int>(x / xstep);
-        int iy = static_cast<int>(y / ystep);
+        // positions on or beyond the edge go into the border cells
+        int ix = std::clamp(static_cast<int>(x / xstep), 0, nx-1);
+        int iy = std::clamp(static_cast<int>(y / ystep), 0, ny-1);
         return grid_coord_to_index(ix, iy);
     }
 
@@ -56,55 +66,303 @@ struct SpaceMap
     }
     */
 
-    void update_atom(std::shared_ptr<Atom> atom) {
+    // returns true if the atom moved to another cell
+    bool update_atom(const std::shared_ptr<Atom>& atom) {
         int old_i = atom->spacemap_index;
         int new_i = position_to_index(atom->x, atom->y);
         if (old_i != new_i) {
             if (old_i>=0) {
                 auto& old_cell = cells[old_i];
                 old_cell.erase(std::remove(old_cell.begin(), old_cell.end(), atom), old_cell.end());
+                if (!atom->sleeping) num_awake[old_i]--;
             }
-            auto& cell = cells[new_i];
             if (new_i >= 0) {
-                cell.push_back(atom);
+                cells[new_i].push_back(atom);
+                if (!atom->sleeping) num_awake[new_i]++;
             }
             atom->spacemap_index = new_i;
+            return true;
         }
+        return false;
+    }
+
+    void clear() {
+        for (auto& cell: cells) {
+            for (auto& atom: cell) {
+                atom->spacemap_index = -1;
+            }
+            cell.clear();
+        }
+        std::fill(num_awake.begin(), num_awake.end(), 0);
+    }
+
+    void set_sleeping(Atom& atom, bool sleeping) {
+        if (atom.sleeping == sleeping) return;
+        atom.sleeping = sleeping;
+        if (atom.spacemap_index >= 0) {
+            num_awake[atom.spacemap_index] += sleeping ? -1 : 1;
+        }
+    }
+
+    void remove_atom(const std::shared_ptr<Atom>& atom) {
+        int index = atom->spacemap_index;
+        if (index < 0) return;
+        auto& cell = cells[index];
+        cell.erase(std::remove(cell.begin(), cell.end(), atom), cell.end());
+        if (!atom->sleeping) num_awake[index]--;
+        atom->spacemap_index = -1;
     }
    
     using AtomPair = std::pair<std::shared_ptr<Atom>, std::shared_ptr<Atom>>;
-    std::vector<AtomPair> get_pairs(float distance) const {
+
+    // The pairs of atoms closer than distance, of which at least one is awake. The distances are
+    // tested 4 at a time (see simd.h), against copies of the positions in arrays by cell. With a
+    // pool, blocks of columns of cells are searched on its threads, and their pairs joined in
+    // order, so the pairs are the same, in the same order, on any number of threads.
+    template<Boundary B>
+    std::vector<AtomPair> get_pairs(float distance, ThreadPool* pool = nullptr) const {
+        PairSearch search;
+        search.distance2 = distance * distance;
+        search.rx = static_cast<int>(distance / xstep)+1;
+        search.ry = static_cast<int>(distance / ystep)+1;
+        // number of neighbouring columns/rows to visit; in a periodic world
+        // the range wraps, but no cell may be visited twice
+        search.span_x = 2*search.rx+1;
+        search.span_y = 2*search.ry+1;
+        if constexpr (B == Boundary::periodic) {
+            search.span_x = std::min(search.span_x, nx);
+            search.span_y = std::min(search.span_y, ny);
+        }
+        gather_positions(search);
+
         std::vector<AtomPair> pairs;
-        int rx = static_cast<int>(distance / xstep)+1;
-        int ry = static_cast<int>(distance / ystep)+1;
-        for (int ix1 = 0; ix1 < nx; ++ix1) {
-            for (int iy1 = 0; iy1 < ny; ++iy1) {
-                int index1 = grid_coord_to_index(ix1, iy1);
-                auto cell1 = cells[index1];
-                if (cell1.empty()) continue;
-                for (int ix2 = ix1-rx; ix2 <= ix1+rx; ++ix2) {
-                    if (ix2<0 || ix2 >= nx) continue;
-                    for (int iy2 = iy1-ry; iy2 <= iy1+ry; ++iy2) {
-                        if (iy2<0 || iy2 >= ny) continue;
-                        int index2 = grid_coord_to_index(ix2, iy2);
-                        if (index2<index1) continue;   // avoid duplicates
-                        auto cell2 = cells[index2];
-                        if (cell2.empty()) continue;
-                        for (auto& atom1 : cell1) {
-                            for (auto& atom2 : cell2) {
-                                if (atom1 != atom2) {
-                                    float dx = atom1->x - atom2->x;
-                                    float dy = atom1->y - atom2->y;
-                                    if (dx * dx + dy * dy < distance * distance) {
-                                        pairs.push_back(std::make_pair(atom1,atom2));
-                                    }
-                                }
-                            }
+        if (!pool || pool->size() == 1) {
+            for (int ix1 = 0; ix1 < nx; ++ix1) {
+                column_pairs<B>(search, ix1, pairs);
+            }
+            return pairs;
+        }
+        int num_blocks = std::min(nx, pool->size() * 4);
+        std::vector<std::vector<AtomPair>> block_pairs(num_blocks);
+        pool->parallel_for(num_blocks, [&](int block) {
+            for (int ix1 = block * nx / num_blocks; ix1 < (block + 1) * nx / num_blocks; ++ix1) {
+                column_pairs<B>(search, ix1, block_pairs[block]);
+            }
+        });
+        size_t num_pairs = 0;
+        for (auto& block: block_pairs) num_pairs += block.size();
+        pairs.reserve(num_pairs);
+        for (auto& block: block_pairs) {
+            std::move(block.begin(), block.end(), std::back_inserter(pairs));
+        }
+        return pairs;
+    }
+
+    // --- queries ---
+    // Queries fill a buffer of the caller with Atom::index values and return a span of it, 
+    // so that repeated queries don't allocate. They only visit the cells around the query.
+    // Positions are not wrapped in a periodic world.
+
+    std::span<const int> atoms_in_rect(float x1, float y1, float x2, float y2, std::vector<int>& buffer) const {
+        buffer.clear();
+        for_cells_in_rect(x1, y1, x2, y2, [&](const Cell& cell) {
+            for (auto& atom: cell) {
+                if (atom->x >= x1 && atom->x <= x2 && atom->y >= y1 && atom->y <= y2) {
+                    buffer.push_back(atom->index);
+                }
+            }
+        });
+        return buffer;
+    }
+
+    std::span<const int> atoms_in_radius(float x, float y, float radius, std::vector<int>& buffer) const {
+        buffer.clear();
+        for_cells_in_rect(x-radius, y-radius, x+radius, y+radius, [&](const Cell& cell) {
+            for (auto& atom: cell) {
+                float dx = atom->x - x;
+                float dy = atom->y - y;
+                if (dx*dx + dy*dy <= radius*radius) {
+                    buffer.push_back(atom->index);
+                }
+            }
+        });
+        return buffer;
+    }
+
+    // nearest atom within max_distance, or nullptr
+    std::shared_ptr<Atom> nearest(float x, float y, float max_distance) const {
+        std::shared_ptr<Atom> best;
+        float best_d2 = max_distance * max_distance;
+        int cx = std::clamp(static_cast<int>(x / xstep), 0, nx-1);
+        int cy = std::clamp(static_cast<int>(y / ystep), 0, ny-1);
+        // rings of cells around the cell of the point, until no closer atom is possible
+        for (int ring=0; ring <= std::max(nx, ny); ++ring) {
+            float ring_distance = (ring-1) * std::min(xstep, ystep);
+            if (ring_distance > 0 && ring_distance * ring_distance > best_d2) break;
+            for (int ix=cx-ring; ix<=cx+ring; ++ix) {
+                for (int iy=cy-ring; iy<=cy+ring; ++iy) {
+                    if (ix != cx-ring && ix != cx+ring && iy != cy-ring && iy != cy+ring) continue;
+                    int index = grid_coord_to_index(ix, iy);
+                    if (index < 0) continue;
+                    for (auto& atom: cells[index]) {
+                        float dx = atom->x - x;
+                        float dy = atom->y - y;
+                        float d2 = dx*dx + dy*dy;
+                        if (d2 <= best_d2) {
+                            best_d2 = d2;
+                            best = atom;
                         }
                     }
                 }
             }
         }
-        return pairs;
+        return best;
+    }
+
+    // bonds that cross the segment (x1,y1)-(x2,y2), as pairs of Atom::index; 
+    // found from the atoms near the segment and their neighbours
+    std::span<const std::pair<int,int>> bonds_crossing(float x1, float y1, float x2, float y2, float max_bond_length,
+                                                       std::vector<std::pair<int,int>>& buffer) const {
+        buffer.clear();
+        float left = std::min(x1, x2) - max_bond_length;
+        float right = std::max(x1, x2) + max_bond_length;
+        float top = std::min(y1, y2) - max_bond_length;
+        float bottom = std::max(y1, y2) + max_bond_length;
+        auto inside = [&](const Atom& atom) {
+            return atom.x >= left && atom.x <= right && atom.y >= top && atom.y <= bottom;
+        };
+        // sign of the turn from (ax,ay) to (bx,by) to (cx,cy)
+        auto orientation = [](float ax, float ay, float bx, float by, float cx, float cy) {
+            float cross = (bx-ax)*(cy-ay) - (by-ay)*(cx-ax);
+            return (cross > 0) - (cross < 0);
+        };
+        for_cells_in_rect(left, top, right, bottom, [&](const Cell& cell) {
+            for (auto& atom: cell) {
+                if (!inside(*atom)) continue;
+                for (Atom* other: atom->neighbours) {
+                    // each bond once: from the lower address, unless the other atom is not visited
+                    if (other < atom.get() && inside(*other)) continue;
+                    float dx = other->x - atom->x;
+                    float dy = other->y - atom->y;
+                    if (dx*dx + dy*dy > max_bond_length * max_bond_length) continue;    // across a periodic edge
+                    if (orientation(x1,y1,x2,y2,atom->x,atom->y) * orientation(x1,y1,x2,y2,other->x,other->y) < 0
+                        && orientation(atom->x,atom->y,other->x,other->y,x1,y1) * orientation(atom->x,atom->y,other->x,other->y,x2,y2) < 0) {
+                        buffer.push_back({atom->index, other->index});
+                    }
+                }
+            }
+        });
+        return buffer;
+    }
+
+private:
+
+    // the atoms of cell i are at first[i] .. first[i+1] of x, y and awake, which have padding
+    // for the last cell, so that 4 values can be read from any atom on
+    struct PairSearch {
+        float distance2 = 0;
+        int rx = 0;
+        int ry = 0;
+        int span_x = 0;
+        int span_y = 0;
+        std::vector<int> first;
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<uint8_t> awake;
+    };
+
+    void gather_positions(PairSearch& search) const {
+        search.first.resize(cells.size() + 1);
+        int num_atoms = 0;
+        for (int i=0;i<cells.size();++i) {
+            search.first[i] = num_atoms;
+            num_atoms += cells[i].size();
+        }
+        search.first[cells.size()] = num_atoms;
+        search.x.assign(num_atoms + 3, 0);
+        search.y.assign(num_atoms + 3, 0);
+        search.awake.assign(num_atoms + 3, 0);
+        for (int i=0;i<cells.size();++i) {
+            int k = search.first[i];
+            for (auto& atom: cells[i]) {
+                search.x[k] = atom->x;
+                search.y[k] = atom->y;
+                search.awake[k] = !atom->sleeping;
+                k++;
+            }
+        }
+    }
+
+    // the pairs of the cells of column ix1 with their neighbours, as get_pairs() orders them
+    template<Boundary B>
+    void column_pairs(const PairSearch& search, int ix1, std::vector<AtomPair>& pairs) const {
+        for (int iy1 = 0; iy1 < ny; ++iy1) {
+            int index1 = grid_coord_to_index(ix1, iy1);
+            const auto& cell1 = cells[index1];
+            if (cell1.empty()) continue;
+            for (int ix2 = ix1-search.rx; ix2 < ix1-search.rx+search.span_x; ++ix2) {
+                int wx2 = ix2;
+                if constexpr (B == Boundary::periodic) {
+                    wx2 = ((ix2 % nx) + nx) % nx;
+                }
+                else if (ix2<0 || ix2 >= nx) continue;
+                for (int iy2 = iy1-search.ry; iy2 < iy1-search.ry+search.span_y; ++iy2) {
+                    int wy2 = iy2;
+                    if constexpr (B == Boundary::periodic) {
+                        wy2 = ((iy2 % ny) + ny) % ny;
+                    }
+                    else if (iy2<0 || iy2 >= ny) continue;
+                    int index2 = grid_coord_to_index(wx2, wy2);
+                    if (index2<index1) continue;   // avoid duplicates
+                    const auto& cell2 = cells[index2];
+                    if (cell2.empty()) continue;
+                    if (num_awake[index1] == 0 && num_awake[index2] == 0) continue;
+                    cell_pairs<B>(search, index1, index2, pairs);
+                }
+            }
+        }
+    }
+
+    template<Boundary B>
+    void cell_pairs(const PairSearch& search, int index1, int index2, std::vector<AtomPair>& pairs) const {
+        const auto& cell1 = cells[index1];
+        const auto& cell2 = cells[index2];
+        int first1 = search.first[index1];
+        int first2 = search.first[index2];
+        int size2 = cell2.size();
+        for (int i=0;i<cell1.size();++i) {
+            // a sleeping atom only pairs with awake ones
+            bool sleeping1 = !search.awake[first1 + i];
+            if (sleeping1 && num_awake[index2] == 0) continue;
+            float x1 = search.x[first1 + i];
+            float y1 = search.y[first1 + i];
+            for (int j=0;j<size2;j+=4) {
+                unsigned close = within4<B>(&search.x[first2 + j], &search.y[first2 + j], x1, y1, xsize, ysize, search.distance2);
+                if (size2 - j < 4) close &= (1u << (size2 - j)) - 1;
+                if (sleeping1) {
+                    const uint8_t* awake = &search.awake[first2 + j];
+                    close &= awake[0] | awake[1] << 1 | awake[2] << 2 | awake[3] << 3;
+                }
+                if (index1 == index2 && i >= j && i < j + 4) close &= ~(1u << (i - j));
+                while (close) {
+                    pairs.push_back(std::make_pair(cell1[i], cell2[j + std::countr_zero(close)]));
+                    close &= close - 1;
+                }
+            }
+        }
+    }
+
+    template<typename Function>
+    void for_cells_in_rect(float x1, float y1, float x2, float y2, Function function) const {
+        if (x2 < 0 || y2 < 0 || x1 > xsize || y1 > ysize) return;
+        int ix1 = std::clamp(static_cast<int>(x1 / xstep), 0, nx-1);
+        int iy1 = std::clamp(static_cast<int>(y1 / ystep), 0, ny-1);
+        int ix2 = std::clamp(static_cast<int>(x2 / xstep), 0, nx-1);
+        int iy2 = std::clamp(static_cast<int>(y2 / ystep), 0, ny-1);
+        for (int iy=iy1; iy<=iy2; ++iy) {
+            for (int ix=ix1; ix<=ix2; ++ix) {
+                function(cells[grid_coord_to_index(ix, iy)]);
+            }
+        }
     }
 };
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads for parallel_for(), started once instead of for every call. The calling
+// thread takes part, so a pool of n threads starts n-1. In the multithreaded web build the
+// threads are web workers, taken from Emscripten's PTHREAD_POOL_SIZE.
+class ThreadPool
+{
+public:
+
+    explicit ThreadPool(int threads) {
+        for (int t=1;t<threads;++t) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_added.notify_all();
+        for (auto& worker: workers) {
+            worker.join();
+        }
+    }
+
+    int size() const { return workers.size() + 1; }
+
+    // f(i) for i in [0, n), in any order and on any of the threads; returns when all are done
+    void parallel_for(int n, const std::function<void(int)>& f) {
+        if (workers.empty() || n <= 1) {
+            for (int i=0;i<n;++i) f(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &f;
+            job_size = n;
+            next = 0;
+            num_finished = 0;
+            generation++;
+        }
+        job_added.notify_all();
+        run();
+        // every worker takes part in every job, so none still reads it after this
+        std::unique_lock<std::mutex> lock(mutex);
+        job_done.wait(lock, [&]() { return num_finished == (int)workers.size(); });
+        job = nullptr;
+    }
+
+    static int hardware_threads() {
+#if defined(WEBAPP) && !defined(SIMULATION_THREAD)
+        return 1;       // a browser can't start threads while the page's thread waits for them
+#else
+        return std::max(1u, std::thread::hardware_concurrency());
+#endif
+    }
+
+private:
+
+    void work() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_added.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            run();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (++num_finished == (int)workers.size()) job_done.notify_one();
+        }
+    }
+
+    void run() {
+        for (int i; (i = next.fetch_add(1)) < job_size;) {
+            (*job)(i);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_done;
+    const std::function<void(int)>* job = nullptr;
+    int job_size = 0;
+    std::atomic<int> next = 0;
+    int num_finished = 0;               // workers done with the current job
+    uint64_t generation = 0;            // of the current job
+    bool stopping = false;
+};
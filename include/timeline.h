@@ -0,0 +1,133 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "compact.h"
+#include "world.h"
+
+// A history of the world that can be scrubbed back and forth. Keyframes, snapshots of the world,
+// are taken every keyframe_interval steps and kept in memory up to max_bytes, the oldest being
+// dropped first. Any step since the oldest keyframe is reconstructed by loading the keyframe
+// before it and simulating up to it, which is exact because the simulation is deterministic,
+// and takes at most keyframe_interval steps.
+//
+// Changes by the user, such as tools, rules and parameters, are not replayed: after a change,
+// call branch(), which drops the history after the current step and starts again from a
+// keyframe of the changed world.
+//
+// With compact set, keyframes are CompactStates, several times smaller, so that a long history of
+// a large soup fits in memory. They are lossy, so a step reconstructed from one is close to, but
+// not the same as, the recorded step.
+class Timeline
+{
+public:
+
+    struct Keyframe {
+        int step = 0;
+        bool is_compact = false;
+        World::Snapshot snapshot;
+        CompactState compact;
+
+        size_t bytes() const { return is_compact ? compact.bytes() : snapshot.bytes(); }
+    };
+
+    void clear() {
+        keyframes.clear();
+        num_bytes = 0;
+        last = -1;
+    }
+
+    // after each live step, i.e. a step that is not replayed
+    void record(const World& world) {
+        if (keyframes.empty() || world.step_count - keyframes.back().step >= keyframe_interval) {
+            add_keyframe(world);
+        }
+        last = world.step_count;
+    }
+
+    // the world was changed at its current step, so the recorded future doesn't follow from it anymore
+    void branch(const World& world) {
+        while (!keyframes.empty() && keyframes.back().step >= world.step_count) {
+            num_bytes -= keyframes.back().bytes();
+            keyframes.pop_back();
+        }
+        add_keyframe(world);
+        last = world.step_count;
+    }
+
+    // Bring the world to the given step, between first() and last(). Continues from the world as it
+    // is if that is on the way, so stepping forward is cheap; otherwise starts from a keyframe.
+    bool seek(World& world, int step) {
+        if (keyframes.empty() || step < first() || step > last) return false;
+        // the statistics and counts are those of the live steps; neither a keyframe nor a replay changes them
+        std::vector<RuleStats> rule_stats;
+        for (auto& rule: world.rules) {
+            rule_stats.push_back(rule->stats);
+        }
+        std::vector<long> region_counts;
+        for (auto& region: world.regions) {
+            region_counts.push_back(region.count);
+        }
+        auto keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), step,
+            [](int step, const Keyframe& keyframe) { return step < keyframe.step; }) - 1;
+        if (world.step_count < keyframe->step || world.step_count > step) {
+            if (keyframe->is_compact) keyframe->compact.decode(world);
+            else world.load(keyframe->snapshot);
+        }
+        // replayed steps are not sampled again
+        int population_interval = world.population_interval;
+        int rule_stats_interval = world.rule_stats_interval;
+        world.population_interval = 0;
+        world.rule_stats_interval = 0;
+        while (world.step_count < step) {
+            world.update();
+        }
+        world.population_interval = population_interval;
+        world.rule_stats_interval = rule_stats_interval;
+        if (world.rules.size() == rule_stats.size()) {
+            for (int i=0;i<rule_stats.size();++i) {
+                world.rules[i]->stats = rule_stats[i];
+            }
+        }
+        if (world.regions.size() == region_counts.size()) {
+            for (int i=0;i<region_counts.size();++i) {
+                world.regions[i].count = region_counts[i];
+            }
+        }
+        return true;
+    }
+
+    int first() const { return keyframes.empty() ? 0 : keyframes.front().step; }
+    int last_step() const { return last; }
+    size_t bytes() const { return num_bytes; }
+    int size() const { return keyframes.size(); }
+
+    int keyframe_interval = 100;                // steps; also the most steps a seek replays
+    size_t max_bytes = 256 * 1024 * 1024;
+    bool compact = false;                       // for new keyframes
+
+private:
+
+    void add_keyframe(const World& world) {
+        if (!keyframes.empty() && keyframes.back().step == world.step_count) {
+            num_bytes -= keyframes.back().bytes();
+            keyframes.pop_back();
+        }
+        keyframes.emplace_back();
+        Keyframe& keyframe = keyframes.back();
+        keyframe.step = world.step_count;
+        keyframe.is_compact = compact;
+        if (keyframe.is_compact) keyframe.compact.encode(world);
+        else world.save(keyframe.snapshot);
+        num_bytes += keyframe.bytes();
+        while (num_bytes > max_bytes && keyframes.size() > 1) {
+            num_bytes -= keyframes.front().bytes();
+            keyframes.pop_front();
+        }
+    }
+
+    std::deque<Keyframe> keyframes;     // oldest first
+    size_t num_bytes = 0;
+    int last = -1;                      // the last recorded step
+};
@@ -1,24 +1,197 @@
 #pragma once
 
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
 // Utility functions
 
-float randf(float min, float max) {
+// Random number generator (PCG32).
+// Each world has its own, so worlds are independent and reproducible from their seed.
+class Random {
+public:
 
-  return ((float)rand() * (max-min) / (float)RAND_MAX) + min;
+  Random(uint64_t seed = 1) {
+    this->seed(seed);
+  }
 
-}
+  void seed(uint64_t seed) {
+    state = 0;
+    next();
+    state += seed;
+    next();
+  }
+
+  uint32_t next() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t xorshifted = ((old >> 18u) ^ old) >> 27u;
+    uint32_t rot = old >> 59u;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
+
+  // uniformly distributed in [min, max]
+  float randf(float min, float max) {
+    return (next() >> 8) * (max-min) / (float)(1 << 24) + min;
+  }
 
+  // normally distributed, with mean 0 (Box-Muller)
+  float randn(float sigma) {
+    float u1 = randf(0,1);
+    float u2 = randf(0,1);
+    if (u1 <= 0) u1 = 1e-7f;
+    return sigma * std::sqrt(-2 * std::log(u1)) * std::cos(2 * (float)M_PI * u2);
+  }
+
+  // uniformly distributed in [0, n)
+  uint32_t below(uint32_t n) {
+    return ((uint64_t)next() * n) >> 32;
+  }
+
+  // Poisson distributed number of events, with the given mean (Knuth's method for small means,
+  // the normal approximation for large ones)
+  int poisson(double mean) {
+    if (mean <= 0) return 0;
+    if (mean > 30) {
+      double n = std::round(mean + std::sqrt(mean) * randn(1));
+      return n < 0 ? 0 : (int)n;
+    }
+    double limit = std::exp(-mean);
+    double product = (next() + 0.5) / 4294967296.0;
+    int n = 0;
+    while (product > limit) {
+      product *= (next() + 0.5) / 4294967296.0;
+      n++;
+    }
+    return n;
+  }
+
+  uint64_t state;
+};
 
 
 // util
 
-template<typename T> std::vector<T> randomize(std::vector<T> in) {
-    // note: input by value, makes a copy, we can safely erase from
-    std::vector<T> out;
-    while( !in.empty()) {
-        int i = rand() % in.size();
-        out.push_back(in[i]);       // copy
-        in.erase(in.begin() + i);
+// mixes the bits of a 64-bit value (the finalizer of SplitMix64)
+inline uint64_t mix_hash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// A random number that depends only on a key and a counter (counter-based random numbers),
+// so that it is the same whoever draws it and in whatever order, unlike those of Random
+inline uint64_t counter_hash(uint64_t key, uint64_t counter) {
+    return mix_hash(key ^ mix_hash(counter + 0x9e3779b97f4a7c15ULL));
+}
+
+// uniformly distributed in [0, 1), from the high bits of a hash
+inline float hash_unit(uint64_t hash) {
+    return (hash >> 40) / (float)(1 << 24);
+}
+
+// shuffled in place (Fisher-Yates)
+template<typename T> void shuffle(std::vector<T>& values, Random& random) {
+    for (size_t i=values.size();i>1;--i) {
+        std::swap(values[i-1], values[random.below(i)]);
     }
-    return out;
 }
+
+template<typename T> std::vector<T> randomize(std::vector<T> in, Random& random) {
+    // note: input by value, makes a copy, we can safely shuffle
+    shuffle(in, random);
+    return in;
+}
+
+// Samples indices with probabilities proportional to weights, in constant time per sample
+// (Vose's alias method). Building the table takes linear time.
+class AliasTable
+{
+public:
+
+    void build(const std::vector<float>& weights) {
+        size_t n = weights.size();
+        probability.assign(n, 0);
+        alias.assign(n, 0);
+        total = 0;
+        for (float weight: weights) total += weight;
+        if (n == 0 || total <= 0) return;
+
+        // weights scaled to a mean of 1; columns below 1 are topped up by one above 1
+        std::vector<double> scaled(n);
+        small.clear();
+        large.clear();
+        for (size_t i=0;i<n;++i) {
+            scaled[i] = weights[i] * n / total;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            small.pop_back();
+            int l = large.back();
+            probability[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // what is left is 1, up to rounding
+        for (int i: large) probability[i] = 1;
+        for (int i: small) probability[i] = 1;
+    }
+
+    int sample(Random& random) const {
+        int i = random.below(probability.size());
+        return (random.randf(0,1) < probability[i]) ? i : alias[i];
+    }
+
+    size_t size() const { return probability.size(); }
+    double sum() const { return total; }
+
+private:
+    std::vector<float> probability;     // of column i, else alias[i]
+    std::vector<int> alias;
+    std::vector<int> small;             // used by build()
+    std::vector<int> large;
+    double total = 0;
+};
+
+// Plain values packed into bytes and read back, e.g. for messages and snapshots
+class ByteWriter
+{
+public:
+    explicit ByteWriter(std::vector<char>& buffer): buffer(buffer) { buffer.clear(); }
+    template<typename T>
+    void write(const T& value) {
+        size_t offset = buffer.size();
+        buffer.resize(offset + sizeof(T));
+        std::memcpy(buffer.data() + offset, &value, sizeof(T));
+    }
+private:
+    std::vector<char>& buffer;
+};
+
+class ByteReader
+{
+public:
+    explicit ByteReader(const std::vector<char>& buffer): buffer(buffer) {}
+    template<typename T>
+    T read() {
+        T value;
+        std::memcpy(&value, buffer.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+    bool done() const { return offset >= buffer.size(); }
+private:
+    const std::vector<char>& buffer;
+    size_t offset = 0;
+};
@@ -0,0 +1,1353 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "atom.h"
+#include "bond.h"
+#include "rule.h"
+#include "spacemap.h"
+#include "physicsparameters.h"
+#include "morton.h"
+#include "clusters.h"
+#include "population.h"
+#include "pool.h"
+#include "region.h"
+#include "profiler.h"
+#include "seeder.h"
+#include "threadpool.h"
+
+using AtomPair = std::pair<const Atom*, const Atom*>;
+template<>
+struct std::hash<AtomPair>
+{
+    std::size_t operator()(const AtomPair& pair) const noexcept
+    {
+        std::size_t h1 = (std::size_t)pair.first;
+        std::size_t h2 = (std::size_t)pair.second;
+        return h1 ^ (h2 << 1);
+    }
+};
+
+// A reference to an atom that stays valid while the atom is moved in the atoms vector or in memory:
+// a slot in the world's handle table, which has the atom's current index, and the generation of
+// the slot. The slot of a removed atom is reused with the next generation, so that its old
+// handles find no atom. See World::handle() and World::atom().
+struct AtomHandle {
+    int slot = -1;
+    uint32_t generation = 0;
+};
+
+// The simulated world: atoms, bonds and the rules that change them.
+// Nothing here draws or needs a window, so a world can also be simulated headless.
+class World {
+public:
+
+    World() {
+        restart();
+    }
+
+    void update() {
+        if (params != last_params) {
+            wake_all();
+            last_params = params;
+        }
+        switch (params.boundary) {
+            case Boundary::reflect: step<Boundary::reflect>(); break;
+            case Boundary::periodic: step<Boundary::periodic>(); break;
+            case Boundary::open: step<Boundary::open>(); break;
+        }
+    }
+
+    template<Boundary B>
+    void step() {
+        debug_num_pairs_tested = 0;
+        debug_num_rules_tested = 0;
+        debug_num_rules_applied = 0;
+        quiet_motion = sleep_velocity * sleep_velocity + 3 * thermal_variance();
+
+        float pair_distance = fmax(params.bonding_start_distance, params.atom_radius*2);
+        std::vector<SpaceMap::AtomPair> pairs;
+        {
+            PROFILE_SCOPE(profiler, Phase::pairs);
+            pairs = spacemap->get_pairs<B>(pair_distance, pair_pool());
+        }
+
+        // try rules 
+        if (decomposable) {
+            simultaneous_reactions(pairs);
+        }
+        else {
+            PROFILE_SCOPE(profiler, Phase::rule_match);
+            using Clock = std::chrono::steady_clock;
+            reaction_candidates.clear();
+            reaction_rates.clear();
+            rule_table.update(rules);
+            for (int p=0;p<(int)pairs.size();++p) {
+                debug_num_pairs_tested++;
+                auto& atom1 = pairs[p].first;
+                auto& atom2 = pairs[p].second;
+                // attempts and time per rule are sampled on every rule_stats_interval-th pair
+                bool sampled = rule_stats_interval > 0 && ++rule_stats_counter % rule_stats_interval == 0;
+                // only the rules that may match the atoms, as they are after the rules before
+                for (int r=-1;(r = rule_table.next(atom1->key, atom2->key, r)) >= 0;) {
+                    Rule& rule = *rules[r];
+                    debug_num_rules_tested ++;
+                    Clock::time_point start;
+                    if (sampled) start = Clock::now();
+                    bool swapped = false;
+                    bool matched = match_rule(rule, atom1, atom2);
+                    if (!matched) {
+                        matched = match_rule(rule, atom2, atom1);
+                        swapped = matched;
+                    }
+                    if (matched && stochastic_rules) {
+                        // applied below
+                        if (rule.rate > 0) {
+                            reaction_candidates.push_back({p, r, swapped});
+                            reaction_rates.push_back(rule.rate);
+                        }
+                    }
+                    else if (matched && (rule.rate >= 1 || random.randf(0,1) < rule.rate)) {
+                        bool blocked = swapped ? !apply_rule(rule, atom2, atom1) : !apply_rule(rule, atom1, atom2);
+                        debug_num_rules_applied++;
+                        rule.stats.hits++;
+                        if (blocked) rule.stats.blocked++;
+                    }
+                    if (sampled) {
+                        std::chrono::duration<double> duration = Clock::now() - start;
+                        rule.stats.attempts += rule_stats_interval;
+                        rule.stats.time += duration.count() * rule_stats_interval;
+                    }
+                }
+            }
+            if (stochastic_rules) {
+                apply_reactions(pairs);
+            }
+        }
+
+        {
+            PROFILE_SCOPE(profiler, Phase::bond_break);
+            auto broken = [&](const std::shared_ptr<Bond>& bond) {
+                return bond->length<B>() > params.bonding_end_distance;
+            };
+            std::vector<std::shared_ptr<Bond>> to_remove;
+            for (auto& bond: bonds) {
+                if (bond->atom1->sleeping) continue;
+                if (broken(bond)) {
+                    set_state(*bond->atom1, 0);
+                    set_state(*bond->atom2, 0);
+                    to_remove.push_back(bond);
+                }
+            };
+            for (auto& bond: to_remove) {
+                remove_bond(*bond);
+            }
+        }
+
+        // enfore bonds
+        {
+            PROFILE_SCOPE(profiler, Phase::bond_force);
+            if (params.integrator == Integrator::verlet) {
+                verlet_step<B>();
+            }
+            else if (decomposable) {
+                bond_forces_by_atom<B>();
+            }
+            else {
+                for (auto& bond: bonds) {
+                    if (bond->atom1->sleeping) continue;
+                    bond->update<B>(params.dt);
+                }
+            }
+        }
+        
+        // collide
+        if (decomposable) {
+            collide_by_atom<B>(pairs);
+        }
+        else {
+            PROFILE_SCOPE(profiler, Phase::collision);
+            for (auto& pair: pairs) {
+                auto& atom1 = pair.first;
+                auto& atom2 = pair.second;
+                if (atom1->collide<B>(*atom2)) {
+                    if (atom1->sleeping) bumped(*atom1, *atom2);
+                    if (atom2->sleeping) bumped(*atom2, *atom1);
+                }
+            }
+        }
+
+        // move atoms
+        {
+            PROFILE_SCOPE(profiler, Phase::integration);
+            float damping = step_damping();
+            float kick = step_kick();
+            uint64_t step_key = counter_hash(random.state, step_count);
+            for (auto& atom: atoms) {
+                if (atom->ghost) continue;      // moved by its own domain
+                if (atom->sleeping) {
+                    if (!islands[atom->island].woken) continue;
+                    wake_atom(*atom);
+                }
+                if (decomposable) {
+                    Random atom_random(counter_hash(step_key, atom->id));
+                    atom->update<B>(atom_random, params.dt, damping, kick);
+                }
+                else {
+                    atom->update<B>(random, params.dt, damping, kick);
+                }
+                if constexpr (B == Boundary::open) {
+                    if (atom->off_world()) removed.push_back(atom->index);
+                }
+                if (spacemap->update_atom(atom)) {
+                    cell_changes_since_reorder++;
+                }
+                atom->motion += (atom->vx*atom->vx + atom->vy*atom->vy - atom->motion) * 0.1f;
+                if (atom->motion < quiet_motion) {
+                    atom->quiet_steps++;
+                } 
+                else {
+                    atom->quiet_steps = 0;
+                }
+            }
+
+            if constexpr (B == Boundary::open) {
+                remove_atoms(removed);
+                removed.clear();
+            }
+        }
+
+        PROFILE_SCOPE(profiler, Phase::housekeeping);
+
+        update_regions();
+
+        step_count++;
+        time += params.dt;
+        if (population_interval > 0 && step_count % population_interval == 0) {
+            population_history.sample(step_count, population);
+        }
+        if (step_count % sleep_check_interval == 0) {
+            update_sleeping();
+        }
+
+        // the more atoms changed cell, the more scattered they are in memory
+        if (reorder_threshold > 0 && cell_changes_since_reorder > reorder_threshold * atoms.size()) {
+            reorder_atoms();
+        }
+    }
+
+    // Velocity Verlet for the bonds, in bond_substeps substeps of dt: half a kick, a drift, 
+    // the new forces and the other half kick. The stiff bond springs stay stable at larger 
+    // time steps than with Euler. Collisions, friction and Brownian motion are applied once per step.
+    template<Boundary B>
+    void verlet_step() {
+        int substeps = std::max(1, params.bond_substeps);
+        float h = params.dt / substeps;
+        bond_accelerations<B>();
+        for (int substep=0;substep<substeps;++substep) {
+            for (auto& atom: atoms) {
+                if (atom->sleeping || atom->ghost) continue;
+                atom->vx += atom->ax * h / 2;
+                atom->vy += atom->ay * h / 2;
+                atom->x += atom->vx * h;
+                atom->y += atom->vy * h;
+            }
+            bond_accelerations<B>();
+            for (auto& atom: atoms) {
+                if (atom->sleeping || atom->ghost) continue;
+                atom->vx += atom->ax * h / 2;
+                atom->vy += atom->ay * h / 2;
+            }
+        }
+    }
+
+    template<Boundary B>
+    void bond_accelerations() {
+        for (auto& atom: atoms) {
+            atom->ax = 0;
+            atom->ay = 0;
+        }
+        for (auto& bond: bonds) {
+            if (bond->atom1->sleeping) continue;
+            bond->accelerate<B>();
+        }
+    }
+
+    // friction per step of dt
+    float step_damping() const {
+        return 1 - std::pow(1 - params.friction, params.dt);
+    }
+
+    // range of the Brownian velocity change per step of dt
+    float step_kick() const {
+        return params.temp * std::sqrt(params.dt);
+    }
+
+    // --- sleeping ---
+    // Islands of bonded atoms that have been quiet for a while, i.e. moving no faster than 
+    // Brownian motion and not reacting, are put to sleep: they are not moved and pairs of 
+    // sleeping atoms are not tested for rules or collisions. An island wakes when a moving 
+    // atom bumps into it, a rule applies to one of its atoms, the parameters or rules change,
+    // or when it has slept so long that its expected Brownian drift exceeds sleep_tolerance. 
+    // On waking, the island is displaced by a random drift for the time slept and its atoms get 
+    // thermal velocities, so temperature still diffuses sleeping islands on average.
+
+    struct Island {
+        int size = 0;
+        int sleep_step = 0;     // step at which the island fell asleep
+        bool woken = false;
+        float dx = 0;           // Brownian drift, applied when woken
+        float dy = 0;
+    };
+
+    // variance of the velocity of a free atom due to Brownian motion, per axis
+    float thermal_variance() const {
+        float damping = step_damping();
+        float kick = step_kick();
+        float a = 1 - damping;
+        if (kick == 0) return 0;
+        if (damping <= 0) return INFINITY;
+        return a * a * kick * kick / 3 / (1 - a * a);
+    }
+
+    // variance of the position of a free atom per step due to Brownian motion, per axis
+    float diffusion_variance() const {
+        float damping = step_damping();
+        float kick = step_kick();
+        float a = 1 - damping;
+        if (kick == 0) return 0;
+        if (damping <= 0) return INFINITY;
+        return a * a * kick * kick * params.dt * params.dt / 3 / (damping * damping);
+    }
+
+    // how long an island can sleep before its expected drift exceeds sleep_tolerance
+    int max_sleep_steps(int island_size) const {
+        float variance = diffusion_variance() / island_size;
+        if (variance == 0) return INT_MAX;
+        return std::min<float>(sleep_tolerance * sleep_tolerance / variance, INT_MAX);
+    }
+
+    void update_sleeping() {
+        if (!sleeping_enabled) {
+            wake_all();
+            return;
+        }
+
+        // islands of bonded atoms are the clusters
+        int n = clusters.clusters.size();
+        std::vector<char> quiet(n, 1);
+        std::vector<int> old_island(n, -1);
+        for (auto& atom: atoms) {
+            if (atom->sleeping) old_island[atom->cluster] = atom->island;
+            else if (atom->quiet_steps < sleep_delay) quiet[atom->cluster] = 0;
+        }
+
+        // sleeping islands keep sleeping, quiet islands fall asleep 
+        std::vector<Island> new_islands;
+        std::vector<int> cluster_island(n, -1);
+        for (int i=0;i<n;++i) {
+            int size = clusters.clusters[i].size;
+            if (size == 0) continue;
+            if (old_island[i] >= 0) {
+                cluster_island[i] = new_islands.size();
+                new_islands.push_back(islands[old_island[i]]);
+            }
+            else if (quiet[i] && max_sleep_steps(size) >= 2 * sleep_check_interval) {
+                cluster_island[i] = new_islands.size();
+                new_islands.push_back({size, step_count});
+            }
+        }
+        islands = std::move(new_islands);
+        for (auto& island: islands) {
+            if (step_count - island.sleep_step >= max_sleep_steps(island.size)) {
+                wake_island(island);
+            }
+        }
+
+        num_sleeping = 0;
+        for (auto& atom: atoms) {
+            atom->island = cluster_island[atom->cluster];
+            if (atom->island >= 0 && !atom->sleeping) {
+                spacemap->set_sleeping(*atom, true);
+                atom->vx = 0;
+                atom->vy = 0;
+            }
+            if (atom->sleeping) num_sleeping++;
+        }
+    }
+
+    void wake_island(Island& island) {
+        if (island.woken) return;
+        island.woken = true;
+        float sigma = std::sqrt(diffusion_variance() * (step_count - island.sleep_step) / island.size);
+        if (!std::isfinite(sigma)) sigma = 0;
+        island.dx = random.randn(sigma);
+        island.dy = random.randn(sigma);
+    }
+
+    void wake_atom(Atom& atom) {
+        auto& island = islands[atom.island];
+        wake_island(island);
+        float sigma = std::sqrt(thermal_variance());
+        if (!std::isfinite(sigma)) sigma = 0;
+        atom.x += island.dx;
+        atom.y += island.dy;
+        atom.vx += random.randn(sigma);
+        atom.vy += random.randn(sigma);
+        atom.quiet_steps = 0;
+        spacemap->set_sleeping(atom, false);
+        num_sleeping--;
+    }
+
+    // wake the island of an atom, if it sleeps
+    void wake(const Atom& atom) {
+        if (atom.sleeping) wake_island(islands[atom.island]);
+    }
+
+    void wake_all() {
+        for (auto& island: islands) {
+            wake_island(island);
+        }
+    }
+
+    // an awake atom collided with a sleeping atom
+    void bumped(Atom& sleeper, const Atom& other) {
+        if (other.motion >= quiet_motion) {
+            wake_island(islands[sleeper.island]);
+        }
+        else {
+            // a sleeping atom doesn't move; it was only in the way
+            sleeper.vx = 0;
+            sleeper.vy = 0;
+            sleeper.correction_x = 0;
+            sleeper.correction_y = 0;
+            sleeper.correction_n = 0;
+        }
+    }
+
+    // Sort the atoms along a Morton curve over the spacemap cells and move them into a new pool,
+    // in that order, so that neighbouring atoms are close in memory. The old pool is freed with
+    // the last old atom. Bonds and spacemap cells are rebuilt to refer to the new atoms. 
+    void reorder_atoms() {
+        std::vector<uint32_t> keys(atoms.size());
+        for (int i=0;i<atoms.size();++i) {
+            int cell = atoms[i]->spacemap_index;
+            keys[i] = (cell < 0) ? UINT32_MAX : morton_code(cell % spacemap->nx, cell / spacemap->nx);
+        }
+        std::vector<int> order = radix_sort_order(keys);
+
+        atom_pool = std::make_shared<NodePool>();
+        std::vector<std::shared_ptr<Atom>> sorted_atoms;
+        sorted_atoms.reserve(atoms.size());
+        for (int i: order) {
+            set_index(*atoms[i], sorted_atoms.size());
+            // the old atom is only used to find its bonds
+            auto atom = std::allocate_shared<Atom>(PoolAllocator<Atom>(atom_pool), std::move(*atoms[i]));
+            atom->num_bonds = 0;        // counted and linked again by the new bonds
+            atom->neighbours.clear();
+            sorted_atoms.push_back(std::move(atom));
+        }
+
+        auto old_bonds = std::move(bonds);
+        bonds.clear();
+        atompair2bond.clear();
+        for (auto& bond: old_bonds) {
+            auto& atom1 = sorted_atoms[bond->atom1->index];
+            auto& atom2 = sorted_atoms[bond->atom2->index];
+            population.remove_bond(*atom1, *atom2);     // counted again by add_bond
+            add_bond(atom1, atom2);
+        }
+        old_bonds.clear();
+
+        atoms = std::move(sorted_atoms);
+        
+        spacemap->clear();
+        for (auto& atom: atoms) {
+            atom->spacemap_index = -1;      // moved from the old atom, which was in the spacemap
+            spacemap->update_atom(atom);
+        }
+
+        cell_changes_since_reorder = 0;
+        debug_num_reorders++;
+    }
+
+    bool match_rule(const Rule& rule, const std::shared_ptr<const Atom>& atom1, const std::shared_ptr<const Atom>& atom2)
+    {
+        bool bonded = atompair2bond.contains(make_atom_pair(atom1.get(),atom2.get()));
+        return rule.match(atom1, atom2, bonded);
+    };
+    
+    // returns false if a bond could not be made because of max_bonds_per_atom
+    bool apply_rule(const Rule& rule, std::shared_ptr<Atom>& atom1, std::shared_ptr<Atom>& atom2)
+    {
+        PROFILE_SCOPE_UNTRACED(profiler, Phase::rule_apply);
+        wake(*atom1);
+        wake(*atom2);
+        atom1->quiet_steps = 0;
+        atom2->quiet_steps = 0;
+        set_state(*atom1, rule.after_state1);
+        set_state(*atom2, rule.after_state2);
+        bool bonded = atompair2bond.contains(make_atom_pair(atom1.get(),atom2.get()));
+        if (rule.after_bonded != bonded) {
+            if (rule.after_bonded) {
+                if (atom1->num_bonds >= params.max_bonds_per_atom) return false;
+                if (atom2->num_bonds >= params.max_bonds_per_atom) return false;
+                add_bond(atom1, atom2);
+            } else {
+                // 
+                remove_bond(make_atom_pair(atom1.get(),atom2.get()));
+            }
+        }
+        return true;
+    };
+    
+    // With stochastic_rules, the matches of the rules to the pairs are the candidate reactions.
+    // Each fires on average its rule's rate times per step: the number of firings is Poisson
+    // distributed with the sum of the rates as mean, and each firing picks a candidate with
+    // probability proportional to its rate (tau-leaping, with a leap of one step). Candidates are
+    // picked from an alias table, in constant time, and in random order, so the order of the
+    // pairs doesn't decide which of two reactions of an atom comes first. A picked candidate
+    // whose atoms have changed since, so that its rule no longer matches, doesn't fire.
+    void apply_reactions(std::vector<SpaceMap::AtomPair>& pairs) {
+        PROFILE_SCOPE(profiler, Phase::rule_match);
+        if (reaction_candidates.empty()) return;
+        reaction_table.build(reaction_rates);
+        int num_firings = random.poisson(reaction_table.sum());
+        for (int i=0;i<num_firings;++i) {
+            const ReactionCandidate& candidate = reaction_candidates[reaction_table.sample(random)];
+            Rule& rule = *rules[candidate.rule];
+            auto& atom1 = candidate.swapped ? pairs[candidate.pair].second : pairs[candidate.pair].first;
+            auto& atom2 = candidate.swapped ? pairs[candidate.pair].first : pairs[candidate.pair].second;
+            if (!match_rule(rule, atom1, atom2)) continue;
+            bool blocked = !apply_rule(rule, atom1, atom2);
+            debug_num_rules_applied++;
+            rule.stats.hits++;
+            if (blocked) rule.stats.blocked++;
+        }
+    }
+
+    // --- decomposable steps ---
+    // With decomposable, the outcome of a step doesn't depend on the order of the atoms, pairs and
+    // bonds, nor on which atoms are further away than three interaction distances. So a world that is
+    // split into domains, each with the atoms of its strip and ghost copies of those near its edges,
+    // gives the same atoms as the whole world, bit for bit; see domain.h. To that end the random
+    // numbers of a step are drawn from the ids of the atoms and the step (counter_hash()), with the
+    // state of random as key, and the sums of forces and collisions on an atom are made by the atom
+    // itself, in the order of the ids of the other atoms. Ghosts are not moved.
+
+    // Pairs in the same spacemap cell come in both orders; the one with the lower id first counts.
+    static bool duplicate_pair(const Atom& atom1, const Atom& atom2) {
+        return atom1.spacemap_index == atom2.spacemap_index && atom1.id > atom2.id;
+    }
+
+    // The reactions are decided from the atoms as they are at the start of the step, rather than
+    // one pair after the other. The first rule of a pair that matches and passes its rate (drawn
+    // from the pair) makes the pair a candidate with a random priority, and a candidate reacts if
+    // it has the highest priority of the candidates of both its atoms. So an atom reacts at most
+    // once per step and all domains that have a pair decide the same for it. Rates are applied as
+    // probabilities per step, also with stochastic_rules.
+    void simultaneous_reactions(std::vector<SpaceMap::AtomPair>& pairs) {
+        PROFILE_SCOPE(profiler, Phase::rule_match);
+        rule_table.update(rules);
+        reaction_candidates.clear();
+        best_candidate.assign(atoms.size(), -1);
+        uint64_t step_key = counter_hash(random.state, step_count) ^ 0x5bd1e9955bd1e995ULL;
+        // the priority, and the ids of the atoms for a tie
+        auto rank = [&](const ReactionCandidate& candidate) {
+            auto& [atom1, atom2] = pairs[candidate.pair];
+            return std::tuple(candidate.priority, std::min(atom1->id, atom2->id), std::max(atom1->id, atom2->id));
+        };
+        for (int p=0;p<(int)pairs.size();++p) {
+            auto& atom1 = pairs[p].first;
+            auto& atom2 = pairs[p].second;
+            if (duplicate_pair(*atom1, *atom2)) continue;
+            debug_num_pairs_tested++;
+            int low = std::min(atom1->id, atom2->id);
+            int high = std::max(atom1->id, atom2->id);
+            uint64_t pair_key = counter_hash(counter_hash(step_key, low), high);
+            for (int r=-1;(r = rule_table.next(atom1->key, atom2->key, r)) >= 0;) {
+                Rule& rule = *rules[r];
+                debug_num_rules_tested++;
+                bool swapped = false;
+                bool matched = match_rule(rule, atom1, atom2);
+                if (!matched) {
+                    matched = match_rule(rule, atom2, atom1);
+                    swapped = matched;
+                }
+                if (!matched) continue;
+                if (rule.rate < 1 && hash_unit(counter_hash(pair_key, r)) >= rule.rate) continue;
+                int candidate = reaction_candidates.size();
+                reaction_candidates.push_back({p, r, swapped, pair_key});
+                for (const Atom* atom: {atom1.get(), atom2.get()}) {
+                    int& best = best_candidate[atom->index];
+                    if (best < 0 || rank(reaction_candidates[best]) < rank(reaction_candidates[candidate])) {
+                        best = candidate;
+                    }
+                }
+                break;
+            }
+        }
+        for (int c=0;c<(int)reaction_candidates.size();++c) {
+            auto& candidate = reaction_candidates[c];
+            auto& pair = pairs[candidate.pair];
+            // also between ghosts, as their new bonds pull them before they collide with owned atoms
+            if (best_candidate[pair.first->index] != c || best_candidate[pair.second->index] != c) continue;
+            Rule& rule = *rules[candidate.rule];
+            auto& atom1 = candidate.swapped ? pair.second : pair.first;
+            auto& atom2 = candidate.swapped ? pair.first : pair.second;
+            bool blocked = !apply_rule(rule, atom1, atom2);
+            // counted by one domain only, that of the atom with the lower id
+            const Atom& first = (atom1->id < atom2->id) ? *atom1 : *atom2;
+            if (first.ghost) continue;
+            debug_num_rules_applied++;
+            rule.stats.hits++;
+            if (blocked) rule.stats.blocked++;
+        }
+    }
+
+    // Euler bond forces; also on ghosts, as their velocities count in the collisions
+    template<Boundary B>
+    void bond_forces_by_atom() {
+        for (auto& atom: atoms) {
+            bond_partners.assign(atom->neighbours.begin(), atom->neighbours.end());
+            std::sort(bond_partners.begin(), bond_partners.end(), [](const Atom* a, const Atom* b) { return a->id < b->id; });
+            for (const Atom* partner: bond_partners) {
+                float fx, fy;
+                Bond::force<B>(*atom, *partner, fx, fy);
+                atom->vx += fx * params.dt;
+                atom->vy += fy * params.dt;
+            }
+        }
+    }
+
+    // Collisions, all with the velocities from before any of them, rather than one pair after the other
+    template<Boundary B>
+    void collide_by_atom(const std::vector<SpaceMap::AtomPair>& pairs) {
+        PROFILE_SCOPE(profiler, Phase::collision);
+        contacts.clear();
+        for (auto& pair: pairs) {
+            auto& atom1 = pair.first;
+            auto& atom2 = pair.second;
+            if (duplicate_pair(*atom1, *atom2)) continue;
+            float dvx, dvy, correct_x, correct_y;
+            if (!atom1->collision<B>(*atom2, dvx, dvy, correct_x, correct_y)) continue;
+            if (!atom1->ghost) contacts.push_back({atom1.get(), atom2.get(), dvx, dvy, correct_x, correct_y});
+            if (!atom2->ghost) contacts.push_back({atom2.get(), atom1.get(), -dvx, -dvy, -correct_x, -correct_y});
+        }
+        std::sort(contacts.begin(), contacts.end(), [](const Contact& a, const Contact& b) {
+            return a.atom->id != b.atom->id ? a.atom->id < b.atom->id : a.other->id < b.other->id;
+        });
+        for (auto& contact: contacts) {
+            Atom& atom = *contact.atom;
+            atom.vx -= contact.dvx;
+            atom.vy -= contact.dvy;
+            atom.correction_n += 1;
+            atom.correction_x -= contact.correct_x;
+            atom.correction_y -= contact.correct_y;
+        }
+    }
+
+    // all state changes go through here, to keep the population counts
+    void set_state(Atom& atom, int state) {
+        population.change_state(atom, state);
+        atom.key = atom_key(atom.type(), state);
+    }
+
+    AtomPair make_atom_pair(const Atom* atom1, const Atom* atom2)
+    {
+        const Atom* left = (atom1<atom2)?atom1:atom2;
+        const Atom* right = (atom1<atom2)?atom2:atom1;
+        return AtomPair(left,right);
+    }
+
+    std::shared_ptr<Bond> add_bond(const std::shared_ptr<Atom>& atom1, const std::shared_ptr<Atom>& atom2) 
+    {
+        auto pair = make_atom_pair(atom1.get(),atom2.get());
+        auto bond = std::make_shared<Bond>(params,atom1,atom2);        
+        bond->index = bonds.size();
+        bonds.push_back(bond);
+        atompair2bond[pair]=bond;
+        clusters.add_bond(*atom1, *atom2);
+        population.add_bond(*atom1, *atom2);
+        return bond;
+    }
+
+    void remove_bond(const AtomPair& pair)
+    {
+        auto it = atompair2bond.find(pair);
+        if (it == atompair2bond.end()) return;
+        clusters.remove_bond(*it->second->atom1, *it->second->atom2);
+        population.remove_bond(*it->second->atom1, *it->second->atom2);
+        // swap with the last bond
+        int index = it->second->index;
+        bonds[index] = bonds.back();
+        bonds[index]->index = index;
+        bonds.pop_back();
+        atompair2bond.erase(it);
+    }
+
+    void remove_bond(const Bond& bond)
+    {
+        remove_bond(make_atom_pair(bond.atom1.get(),bond.atom2.get()));
+    }
+
+    // average distance in memory between atoms that are consecutive in the atoms vector;
+    // a measure of locality, as a reordered soup has the size of a pool node here
+    float mean_atom_stride() const {
+        if (atoms.size() < 2) return 0;
+        double total = 0;
+        for (int i=1;i<atoms.size();++i) {
+            total += std::abs((const char*)atoms[i].get() - (const char*)atoms[i-1].get());
+        }
+        return total / (atoms.size()-1);
+    }
+
+    // Memory used by the atoms, the bonds and the spacemap, estimated from the sizes of the
+    // objects and containers, without the overhead of the heap. Atoms: the pool nodes of the live
+    // atoms (each an atom with its shared_ptr control block; all atoms come from atom_pool), the
+    // atoms vector, the neighbour lists and the cluster tracker. Bonds: the bonds with their
+    // control blocks, the bonds vector and the nodes and buckets of atompair2bond. See
+    // CompactState for the size of a compact copy.
+    struct MemoryUsage {
+        size_t atoms = 0;
+        size_t bonds = 0;
+        size_t spacemap = 0;
+        size_t total() const { return atoms + bonds + spacemap; }
+    };
+
+    MemoryUsage memory_usage() const {
+        MemoryUsage usage;
+        usage.atoms = atom_pool->bytes() + atoms.capacity() * sizeof(std::shared_ptr<Atom>) + clusters.bytes();
+        for (auto& atom: atoms) {
+            usage.atoms += atom->neighbours.capacity() * sizeof(Atom*);
+        }
+        // make_shared puts the control block, two counts and a vtable pointer, before the bond
+        size_t bond_block = sizeof(Bond) + 2 * sizeof(int) + sizeof(void*);
+        // a map node: the next pointer, the key and value, and the cached hash
+        size_t map_node = sizeof(void*) + sizeof(std::pair<const AtomPair, std::shared_ptr<Bond>>) + sizeof(size_t);
+        usage.bonds = bonds.size() * bond_block + bonds.capacity() * sizeof(std::shared_ptr<Bond>)
+                    + atompair2bond.size() * map_node + atompair2bond.bucket_count() * sizeof(void*);
+        usage.spacemap = spacemap->cells.capacity() * sizeof(SpaceMap::Cell) + spacemap->num_awake.capacity() * sizeof(int);
+        for (auto& cell: spacemap->cells) {
+            usage.spacemap += cell.capacity() * sizeof(std::shared_ptr<Atom>);
+        }
+        return usage;
+    }
+
+    void resize() {
+        if (params.boundary == Boundary::periodic) {
+            for (auto& atom: atoms) {
+                atom->wrap();
+            }
+        }
+        else {
+            removed.clear();
+            for (auto& atom: atoms) {
+                if (atom->off_world()) removed.push_back(atom->index);
+            }
+            remove_atoms(removed);
+            removed.clear();
+        }
+
+        spacemap = std::make_unique<SpaceMap>(params.space_width, params.space_height, params.atom_radius*2, params.atom_radius*2);
+        for (auto& atom: atoms) {
+            atom->spacemap_index = -1;
+            spacemap->update_atom(atom);
+        }
+    }
+
+    // new atoms come from a pool, see pool.h
+    std::shared_ptr<Atom> add_atom(float x, float y, int type, int state) {
+        auto atom = std::allocate_shared<Atom>(PoolAllocator<Atom>(atom_pool), params, x, y, type, state);
+        atom->id = next_atom_id++;
+        insert_atom(atom);
+        spacemap->update_atom(atom);
+        clusters.add_atom(*atom);
+        population.add_atom(*atom);
+        return atom;
+    }
+
+    // remove the atoms with the given indices and their bonds; the last atoms are moved 
+    // into their places, so this only costs as much as the atoms and their bonds
+    void remove_atoms(std::span<const int> indices) {
+        // highest first, so that no atom still to be removed is moved
+        removing.assign(indices.begin(), indices.end());
+        std::sort(removing.begin(), removing.end(), std::greater<int>());
+        removing.erase(std::unique(removing.begin(), removing.end()), removing.end());
+        for (int index: removing) {
+            auto atom = atoms[index];
+            while (!atom->neighbours.empty()) {
+                remove_bond(make_atom_pair(atom.get(), atom->neighbours.back()));
+            }
+            wake(*atom);
+            if (atom->sleeping) num_sleeping--;
+            spacemap->remove_atom(atom);
+            clusters.remove_atom(*atom);
+            population.remove_atom(*atom);
+            atoms[index] = atoms.back();
+            set_index(*atoms[index], index);
+            atoms.pop_back();
+            // after the move, as the atom may have been the last one
+            release_slot(*atom);
+            atom->index = -1;
+        }
+    }
+
+    // --- handles ---
+
+    AtomHandle handle(const std::shared_ptr<Atom>& atom) const {
+        if (!atom || atom->slot < 0) return {};
+        return {atom->slot, handle_slots[atom->slot].generation};
+    }
+
+    // the atom of the handle, nullptr if it was removed
+    std::shared_ptr<Atom> atom(AtomHandle handle) const {
+        if (handle.slot < 0 || handle.slot >= handle_slots.size()) return nullptr;
+        auto& slot = handle_slots[handle.slot];
+        if (slot.generation != handle.generation || slot.index < 0) return nullptr;
+        return atoms[slot.index];
+    }
+
+    // --- sources and sinks ---
+
+    void update_regions() {
+        for (auto& region: regions) {
+            if (region.kind == Region::Kind::emitter) {
+                region.emit_credit += region.rate;
+                for (; region.emit_credit >= 1; region.emit_credit -= 1) {
+                    // a few tries to find room; if there is none, the atom is not made
+                    for (int attempt=0;attempt<8;++attempt) {
+                        float x = random.randf(region.x, region.x + region.width);
+                        float y = random.randf(region.y, region.y + region.height);
+                        if (x < params.atom_radius || x > params.space_width - params.atom_radius) continue;
+                        if (y < params.atom_radius || y > params.space_height - params.atom_radius) continue;
+                        if (!spacemap->atoms_in_radius(x, y, params.atom_radius*2, query_buffer).empty()) continue;
+                        add_atom(x, y, region.type, region.state);
+                        region.count++;
+                        break;
+                    }
+                }
+            }
+            else {
+                removed.clear();
+                for (int index: spacemap->atoms_in_rect(region.x, region.y, region.x + region.width, region.y + region.height, query_buffer)) {
+                    if (region.accepts(*atoms[index])) removed.push_back(index);
+                }
+                region.count += removed.size();
+                remove_atoms(removed);
+            }
+        }
+        removed.clear();
+    }
+
+    // the pool for the pair search, for the number of threads; nullptr for one thread
+    ThreadPool* pair_pool() {
+        int wanted = threads > 0 ? threads : ThreadPool::hardware_threads();
+        if (wanted <= 1) {
+            thread_pool.reset();
+            return nullptr;
+        }
+        if (!thread_pool || thread_pool->size() != wanted) {
+            thread_pool = std::make_unique<ThreadPool>(wanted);
+        }
+        return thread_pool.get();
+    }
+
+    // no atoms and bonds, and a new spacemap for the atom size and world size
+    void clear() {
+        release_atoms();
+        bonds.clear();
+        atompair2bond.clear();
+        clusters.clear();
+        population.clear();
+        islands.clear();
+        num_sleeping = 0;
+        next_atom_id = 0;
+        spacemap = std::make_unique<SpaceMap>(params.space_width, params.space_height, params.atom_radius*2, params.atom_radius*2);
+    }
+
+    void restart() {
+        clear();
+        population_history.clear();
+        for (auto& region: regions) {
+            region.count = 0;
+            region.emit_credit = 0;
+        }
+
+        if (start_layout == StartLayout::random && start_molecules.empty()) {
+            // create random atoms
+            for (int type=0;type<start_atoms.size();++type) {
+                for (int i=0;i<start_atoms[type];++i) {
+                    float x=random.randf(0,params.space_width);
+                    float y=random.randf(0,params.space_height);
+                    add_atom(x, y, type, 0);
+                }
+            }
+            reorder_atoms();
+        }
+        else {
+            seed_atoms();
+        }
+    }
+
+    // The start atoms and molecules without overlap, see Seeder. The atoms are made in Morton
+    // order, as reorder_atoms() would leave them, instead of being reordered afterwards.
+    void seed_atoms() {
+        Seeder seeder;
+        seeder.seed(params, start_atoms, start_molecules, random, start_threads);
+        if (seeder.missing_atoms > 0 || seeder.missing_molecules > 0) {
+            std::cerr << "no room for " << seeder.missing_atoms << " atoms and " << seeder.missing_molecules << " molecules\n";
+        }
+        int n = seeder.atoms.size();
+        std::vector<uint32_t> keys(n);
+        for (int i=0;i<n;++i) {
+            int cell = spacemap->position_to_index(seeder.atoms[i].x, seeder.atoms[i].y);
+            keys[i] = (cell < 0) ? UINT32_MAX : morton_code(cell % spacemap->nx, cell / spacemap->nx);
+        }
+        std::vector<int> order = radix_sort_order(keys);
+
+        atoms.reserve(atoms.size() + n);
+        std::vector<int> index_of(n);       // of each placement in atoms
+        for (int i: order) {
+            auto& placement = seeder.atoms[i];
+            auto atom = std::allocate_shared<Atom>(PoolAllocator<Atom>(atom_pool), params, placement.x, placement.y,
+                                                   key_type(placement.key), key_state(placement.key));
+            atom->id = next_atom_id + i;
+            index_of[i] = atoms.size();
+            insert_atom(atom);
+            spacemap->update_atom(atom);
+            clusters.add_atom(*atom);
+            population.add_atom(*atom);
+        }
+        next_atom_id += n;
+        for (auto [i, j]: seeder.bonds) {
+            add_bond(atoms[index_of[i]], atoms[index_of[j]]);
+        }
+        cell_changes_since_reorder = 0;
+    }
+
+    // A hash of the atoms (id, type, state, position and velocity) and the bonds. It doesn't
+    // depend on the order of atoms and bonds, so worlds that differ only in memory layout have
+    // the same hash. See DifferentialChecker.
+    uint64_t state_hash() const {
+        uint64_t hash = mix_hash(atoms.size()) ^ mix_hash(bonds.size() + 0x9e3779b97f4a7c15ULL);
+        for (auto& atom: atoms) {
+            uint64_t h = mix_hash(atom->id);
+            // the type as the letter it was before atom keys, so hash logs of older builds still compare
+            h = mix_hash(h ^ ((uint64_t)('a' + atom->type()) << 32 | (uint32_t)atom->state()));
+            h = mix_hash(h ^ ((uint64_t)std::bit_cast<uint32_t>(atom->x) << 32 | std::bit_cast<uint32_t>(atom->y)));
+            h = mix_hash(h ^ ((uint64_t)std::bit_cast<uint32_t>(atom->vx) << 32 | std::bit_cast<uint32_t>(atom->vy)));
+            hash += h;
+        }
+        for (auto& bond: bonds) {
+            int id1 = std::min(bond->atom1->id, bond->atom2->id);
+            int id2 = std::max(bond->atom1->id, bond->atom2->id);
+            hash += mix_hash(mix_hash(id1) ^ ((uint64_t)id2 << 32));
+        }
+        return hash;
+    }
+
+    // set a parameter or a setting by its name; returns false for unknown names
+    bool set(const std::string& name, float value) {
+        if (params.set(name, value)) return true;
+        if (name == "reorder_threshold") reorder_threshold = value;
+        else if (name == "sleeping") sleeping_enabled = value != 0;
+        else if (name == "stochastic_rules") stochastic_rules = value != 0;
+        else if (name == "start_layout") start_layout = static_cast<StartLayout>(value);
+        else if (name == "sleep_velocity") sleep_velocity = value;
+        else if (name == "sleep_tolerance") sleep_tolerance = value;
+        else if (name == "sleep_delay") sleep_delay = value;
+        else if (name == "sleep_check_interval") sleep_check_interval = value;
+        else if (name == "threads") threads = value;
+        else return false;
+        return true;
+    }
+
+    // --- snapshots ---
+    // Everything update() depends on, so that after load() the world continues exactly as it did
+    // after save(): the order of the atoms, bonds, spacemap cells and neighbour lists, the cluster
+    // ids, the sleeping islands and the random state. Not saved are the statistics, the population
+    // history and settings that are not parameters, such as sleeping_enabled. See Timeline.
+
+    struct Snapshot {
+        int step_count = 0;
+        double time = 0;
+        int next_atom_id = 0;
+        int cell_changes_since_reorder = 0;
+        uint64_t random_state = 0;
+        PhysicsParameters params;
+        PhysicsParameters last_params;
+        std::vector<Rule> rules;
+        std::vector<Region> regions;
+        std::vector<Island> islands;
+        int num_sleeping = 0;
+        ClusterTracker clusters;
+        Population population;
+        std::vector<char> atom_data;    // per atom, in order: see save()
+        std::vector<int> bond_data;     // atom indices of the bonds, in order
+
+        // approximate memory use
+        size_t bytes() const {
+            return sizeof(Snapshot) + atom_data.size() + bond_data.size() * sizeof(int)
+                + rules.size() * sizeof(Rule) + regions.size() * sizeof(Region) + islands.size() * sizeof(Island)
+                + clusters.clusters.size() * sizeof(ClusterTracker::Cluster) + clusters.size_histogram.size() * sizeof(int)
+                + population.atom_counts.size() * sizeof(int);
+        }
+    };
+
+    void save(Snapshot& snapshot) const {
+        snapshot.step_count = step_count;
+        snapshot.time = time;
+        snapshot.next_atom_id = next_atom_id;
+        snapshot.cell_changes_since_reorder = cell_changes_since_reorder;
+        snapshot.random_state = random.state;
+        snapshot.params = params;
+        snapshot.last_params = last_params;
+        snapshot.rules.clear();
+        for (auto& rule: rules) {
+            snapshot.rules.push_back(*rule);
+        }
+        snapshot.regions = regions;
+        snapshot.islands = islands;
+        snapshot.num_sleeping = num_sleeping;
+        snapshot.clusters = clusters;
+        snapshot.population = population;
+
+        // the place of each atom in its spacemap cell
+        std::vector<int> slots(atoms.size(), -1);
+        for (auto& cell: spacemap->cells) {
+            for (int slot=0;slot<cell.size();++slot) {
+                slots[cell[slot]->index] = slot;
+            }
+        }
+        ByteWriter writer(snapshot.atom_data);
+        for (auto& atom: atoms) {
+            writer.write(atom->id);
+            writer.write(atom->key);
+            writer.write(atom->x);
+            writer.write(atom->y);
+            writer.write(atom->vx);
+            writer.write(atom->vy);
+            writer.write(atom->ax);
+            writer.write(atom->ay);
+            writer.write(atom->correction_x);
+            writer.write(atom->correction_y);
+            writer.write(atom->correction_n);
+            writer.write(atom->ghost);
+            writer.write(atom->sleeping);
+            writer.write(atom->island);
+            writer.write(atom->motion);
+            writer.write(atom->quiet_steps);
+            writer.write(atom->cluster);
+            writer.write(atom->spacemap_index);
+            writer.write(slots[atom->index]);
+            writer.write((int)atom->neighbours.size());
+            for (Atom* neighbour: atom->neighbours) {
+                writer.write(neighbour->index);
+            }
+        }
+        snapshot.bond_data.clear();
+        for (auto& bond: bonds) {
+            snapshot.bond_data.push_back(bond->atom1->index);
+            snapshot.bond_data.push_back(bond->atom2->index);
+        }
+    }
+
+    void load(const Snapshot& snapshot) {
+        step_count = snapshot.step_count;
+        time = snapshot.time;
+        next_atom_id = snapshot.next_atom_id;
+        cell_changes_since_reorder = snapshot.cell_changes_since_reorder;
+        random.state = snapshot.random_state;
+        bool resized = params.space_width != snapshot.params.space_width || params.space_height != snapshot.params.space_height
+                    || params.atom_radius != snapshot.params.atom_radius;
+        params = snapshot.params;
+        last_params = snapshot.last_params;
+        rules.clear();
+        for (auto& rule: snapshot.rules) {
+            rules.push_back(std::make_unique<Rule>(rule));
+        }
+        regions = snapshot.regions;
+        islands = snapshot.islands;
+        num_sleeping = snapshot.num_sleeping;
+        clusters = snapshot.clusters;
+        population = snapshot.population;
+
+        bonds.clear();
+        atompair2bond.clear();
+        release_atoms();
+        if (resized) spacemap = std::make_unique<SpaceMap>(params.space_width, params.space_height, params.atom_radius*2, params.atom_radius*2);
+        else spacemap->clear();
+
+        ByteReader reader(snapshot.atom_data);
+        std::vector<std::pair<int,int>> places;     // cell and slot per atom
+        std::vector<std::vector<int>> neighbours;
+        while (!reader.done()) {
+            int id = reader.read<int>();
+            AtomKey key = reader.read<AtomKey>();
+            float x = reader.read<float>();
+            float y = reader.read<float>();
+            auto atom = std::allocate_shared<Atom>(PoolAllocator<Atom>(atom_pool), params, x, y, key_type(key), key_state(key));
+            atom->id = id;
+            atom->vx = reader.read<float>();
+            atom->vy = reader.read<float>();
+            atom->ax = reader.read<float>();
+            atom->ay = reader.read<float>();
+            atom->correction_x = reader.read<float>();
+            atom->correction_y = reader.read<float>();
+            atom->correction_n = reader.read<int>();
+            atom->ghost = reader.read<bool>();
+            atom->sleeping = reader.read<bool>();
+            atom->island = reader.read<int>();
+            atom->motion = reader.read<float>();
+            atom->quiet_steps = reader.read<int>();
+            atom->cluster = reader.read<int>();
+            int cell = reader.read<int>();
+            int slot = reader.read<int>();
+            places.push_back({cell, slot});
+            neighbours.emplace_back(reader.read<int>());
+            for (int& neighbour: neighbours.back()) {
+                neighbour = reader.read<int>();
+            }
+            insert_atom(atom);
+        }
+
+        // the cells in their saved order, as that is the order of the pairs
+        for (auto& atom: atoms) {
+            auto [cell, slot] = places[atom->index];
+            if (cell < 0) continue;
+            auto& atoms_in_cell = spacemap->cells[cell];
+            if (atoms_in_cell.size() <= slot) atoms_in_cell.resize(slot + 1);
+            atoms_in_cell[slot] = atom;
+            atom->spacemap_index = cell;
+            if (!atom->sleeping) spacemap->num_awake[cell]++;
+        }
+        for (auto& atom: atoms) {
+            for (int neighbour: neighbours[atom->index]) {
+                atom->neighbours.push_back(atoms[neighbour].get());
+            }
+        }
+        // the neighbours and clusters are already linked
+        for (int i=0;i<snapshot.bond_data.size();i+=2) {
+            auto& atom1 = atoms[snapshot.bond_data[i]];
+            auto& atom2 = atoms[snapshot.bond_data[i+1]];
+            auto bond = std::make_shared<Bond>(params, atom1, atom2);
+            bond->index = bonds.size();
+            bonds.push_back(bond);
+            atompair2bond[make_atom_pair(atom1.get(), atom2.get())] = bond;
+        }
+    }
+
+    // one rule per line, in the format of Rule::toText(); empty lines and lines starting with # are skipped
+    bool load_rules(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) {
+            std::cerr << "cannot open rules file " << filename << "\n";
+            return false;
+        }
+        std::string line;
+        int line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') continue;
+            auto rule = Rule::fromText(line);
+            if (!rule) {
+                std::cerr << filename << ":" << line_number << ": invalid rule " << line << "\n";
+                return false;
+            }
+            rules.push_back(std::make_unique<Rule>(*rule));
+        }
+        wake_all();
+        return true;
+    }
+
+    // molecules to start with, one MoleculeTemplate per line
+    bool load_molecules(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) {
+            std::cerr << "cannot open molecules file " << filename << "\n";
+            return false;
+        }
+        std::string line;
+        int line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') continue;
+            auto molecule = MoleculeTemplate::fromText(line);
+            if (!molecule) {
+                std::cerr << filename << ":" << line_number << ": invalid molecule " << line << "\n";
+                return false;
+            }
+            start_molecules.push_back(*molecule);
+        }
+        return true;
+    }
+
+    void reset_rule_stats() {
+        for (auto& rule: rules) {
+            rule->stats = RuleStats();
+        }
+    }
+
+    // fraction of the time spent on rules, that is spent on the given rule
+    float rule_time_share(const Rule& rule) const {
+        double total = 0;
+        for (auto& other: rules) {
+            total += other->stats.time;
+        }
+        return (total > 0) ? rule.stats.time / total : 0;
+    }
+
+    void write_rule_stats(std::ostream& out) const {
+        out << "rule,attempts,hits,blocked,time_ms,time_share\n";
+        for (auto& rule: rules) {
+            out << rule->toText() << ","
+                << (long)rule->stats.attempts << ","
+                << rule->stats.hits << ","
+                << rule->stats.blocked << ","
+                << rule->stats.time * 1000 << ","
+                << rule_time_share(*rule) << "\n";
+        }
+    }
+
+    // ----- variables ------
+
+    // parameters 
+    std::vector<int> start_atoms = std::vector<int>(6, 16);    // per type; the number of types at the start
+    std::vector<MoleculeTemplate> start_molecules;              // always placed as with StartLayout::grid
+    StartLayout start_layout = StartLayout::random;
+    int start_threads = 0;          // for StartLayout::grid; 0: all hardware threads
+    int threads = 1;                // for the pair search, see SpaceMap::get_pairs(); 0: all hardware threads
+    PhysicsParameters params;
+    PhysicsParameters last_params;      // to detect changes
+    
+    float reorder_threshold = 2.0f; // reorder atoms in memory after this many cell changes per atom 
+    bool sleeping_enabled = false;
+    bool stochastic_rules = false;  // sample the reactions of a step by rule rate, see apply_reactions()
+    bool decomposable = false;      // steps that domains can split, see "decomposable steps"; set by domain.h
+    float sleep_velocity = 0.05f;   // speed above Brownian motion at which atoms are not quiet
+    float sleep_tolerance = 8.0f;   // maximum expected Brownian drift while asleep
+    int sleep_delay = 60;           // number of quiet steps before an atom may sleep
+    int sleep_check_interval = 16;  // steps between searches for quiet islands
+    int rule_stats_interval = 16;   // sample rule statistics on every n-th pair; 0 = off
+    int population_interval = 10;   // steps between population samples; 0 = off
+
+    // data
+    Random random;
+    std::unique_ptr<SpaceMap> spacemap;
+    std::unique_ptr<ThreadPool> thread_pool;    // see pair_pool()
+    std::vector<std::shared_ptr<Atom>> atoms;
+    std::shared_ptr<NodePool> atom_pool = std::make_shared<NodePool>();
+    std::vector<std::shared_ptr<Bond>> bonds;   // in a deterministic order, unlike atompair2bond
+    std::vector<std::unique_ptr<Rule>> rules;
+    RuleTable rule_table;               // the rules by atom key, kept up to date by step()
+    std::vector<Island> islands;        // sleeping islands, indexed by Atom::island
+    ClusterTracker clusters;            // molecules: connected atoms
+    Population population;              // atoms per type and state, bonds per type pair
+    PopulationHistory population_history;
+    std::vector<Region> regions;        // sources and sinks of atoms
+
+    // for finding bonds; iterate over bonds instead, as the order of this map depends on memory addresses
+    // TODO: instead of this map, we could use an unordered set of bonds with a proper hash and compare for bonds...
+    std::unordered_map<AtomPair,std::shared_ptr<Bond>> atompair2bond;
+
+    int step_count = 0;
+    int next_atom_id = 0;
+    double time = 0;                    // simulated time, the sum of dt
+    int cell_changes_since_reorder = 0;
+    int num_sleeping = 0;
+    float quiet_motion = 0;             // atoms with less motion are quiet
+    long rule_stats_counter = 0;        // pairs seen, for sampling rule statistics
+    std::vector<int> query_buffer;      // for spacemap queries
+    std::vector<int> removed;           // indices of atoms to remove
+    std::vector<int> removing;          // used by remove_atoms()
+
+    // the handle table, see AtomHandle
+    struct HandleSlot {
+        uint32_t generation = 0;
+        int index = -1;                 // of the atom in atoms, -1 if the slot is free
+    };
+    std::vector<HandleSlot> handle_slots;
+    std::vector<int> free_handle_slots;
+
+    // append an atom to atoms, with a handle slot
+    void insert_atom(const std::shared_ptr<Atom>& atom) {
+        if (free_handle_slots.empty()) {
+            free_handle_slots.push_back(handle_slots.size());
+            handle_slots.emplace_back();
+        }
+        atom->slot = free_handle_slots.back();
+        free_handle_slots.pop_back();
+        atoms.push_back(atom);
+        set_index(*atom, atoms.size() - 1);
+    }
+
+    void set_index(Atom& atom, int index) {
+        atom.index = index;
+        handle_slots[atom.slot].index = index;
+    }
+
+    void release_slot(Atom& atom) {
+        auto& slot = handle_slots[atom.slot];
+        slot.generation++;
+        slot.index = -1;
+        free_handle_slots.push_back(atom.slot);
+        atom.slot = -1;
+    }
+
+    // empty atoms; the atoms made next come from a new pool
+    void release_atoms() {
+        for (auto& atom: atoms) {
+            release_slot(*atom);
+            atom->index = -1;
+        }
+        atoms.clear();
+        atom_pool = std::make_shared<NodePool>();
+    }
+
+    // candidate reactions of a step, for apply_reactions()
+    struct ReactionCandidate {
+        int pair;                       // index into the pairs of the step
+        int rule;                       // index into rules
+        bool swapped;                   // the rule matches the second atom of the pair as its first
+        uint64_t priority = 0;          // see simultaneous_reactions()
+    };
+    std::vector<ReactionCandidate> reaction_candidates;
+    std::vector<float> reaction_rates;
+    AliasTable reaction_table;
+    std::vector<int> best_candidate;    // per atom, see simultaneous_reactions()
+
+    // a collision of atom with other, see collide_by_atom()
+    struct Contact {
+        Atom* atom;
+        const Atom* other;
+        float dvx;
+        float dvy;
+        float correct_x;
+        float correct_y;
+    };
+    std::vector<Contact> contacts;
+    std::vector<const Atom*> bond_partners;     // see bond_forces_by_atom()
+
+    // Performance variables
+    // TODO: rename debug->performance; or put in a struct
+    int debug_num_pairs_tested = 0;
+    int debug_num_rules_tested = 0;
+    int debug_num_rules_applied = 0;
+    int debug_num_reorders = 0;
+#ifdef PROFILER
+    Profiler profiler;
+#endif
+};
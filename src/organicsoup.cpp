@@ -4,9 +4,18 @@
 // Define WEBAPP when compiling a web applicaion with Emscripten (cpp -> html+js+wasm)
 // Set from the Makefile with with a preprocessor flag, e.g. -DWEBAPP
 // #define WEBAPP
+// Define HEADLESS for a build of only the headless runs, without SDL, ImGui or a window
+// (and without the frame export, which draws with SDL), e.g. for Node.js
 
+#if defined(PROFILER) && defined(SIMULATION_THREAD)
+// the profiler's frames are written by the simulation thread and read by the drawing thread without a lock
+#error "PROFILER and SIMULATION_THREAD can't be defined together"
+#endif
+
+#ifndef HEADLESS
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#endif
 
 // C++ includes
 #include <stdlib.h>
@@ -15,33 +24,45 @@
 #include <memory>
 #include <chrono>
 #include <unordered_map>
+#include <fstream>
+#include <iostream>
+#ifdef SIMULATION_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 
 // my includes
 #include "atom.h"
-#include "atomrenderer.h"
 #include "bond.h"
 #include "rule.h"
 #include "spacemap.h"
 #include "physicsparameters.h"
+#include "profiler.h"
+#include "world.h"
+#include "ensemble.h"
+#include "timeline.h"
+#include "compact.h"
+#include "compactworld.h"
+#include "checker.h"
+#ifndef WEBAPP
+#include "domain.h"
+#include "metrics.h"
+#endif
+
+#ifndef HEADLESS
+#include "atomrenderer.h"
+#include "scene.h"
+#ifndef WEBAPP
+#include "exporter.h"
+#endif
 
 // Dear ImGui
 #include "imgui.h"
 #include "backends/imgui_impl_sdl2.h"
 #include "backends/imgui_impl_opengl3.h"
 
-using AtomPair = std::pair<const Atom*, const Atom*>;
-template<>
-struct std::hash<AtomPair>
-{
-    std::size_t operator()(const AtomPair& pair) const noexcept
-    {
-        std::size_t h1 = (std::size_t)pair.first;
-        std::size_t h2 = (std::size_t)pair.second;
-        return h1 ^ (h2 << 1);
-    }
-};
-
 class Application {
 public:
 
@@ -51,8 +72,8 @@ public:
         //  fixed size for now
         const int window_width = 1600;
         const int window_height = 900;
-        params.space_width = window_width;
-        params.space_height = window_height;
+        world.params.space_width = window_width;
+        world.params.space_height = window_height;
         
         SDL_CreateWindowAndRenderer(window_width, window_height, SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL, &window, &renderer);
 
@@ -68,20 +89,52 @@ public:
         // rules.push_back(std::make_unique<Rule>('d', 0, false, 'e', 0, 1, true, 0));
         // rules.push_back(std::make_unique<Rule>('e', 0, false, 'f', 0, 1, true, 0));
          
-        restart();
+        world.restart();
+        timeline.branch(world);
+
+#ifdef SIMULATION_THREAD
+        world.threads = 0;      // the pair search on all cores, while this thread draws
+        simulation_thread = std::thread([this]() { simulate(); });
+#endif
+    }
 
+#ifdef SIMULATION_THREAD
+    ~Application() {
+        {
+            std::lock_guard<std::mutex> lock(world_mutex);
+            quit = true;
+        }
+        simulation_requested.notify_one();
+        simulation_thread.join();
     }
+#endif
 
     void frame() {
 
         auto clock_start = std::chrono::high_resolution_clock::now();
-
+        PROFILE_BEGIN_FRAME(world.profiler);
+
+#ifdef SIMULATION_THREAD
+        {
+            // the world is ours until the next steps are requested; they are simulated while this frame is drawn
+            std::unique_lock<std::mutex> lock(world_mutex);
+            simulation_done.wait(lock, [&]() { return !simulating; });
+            handle_events();
+            prepare_draw();
+            simulating = !paused;
+        }
+        simulation_requested.notify_one();
+        finish_draw();
+#else
         handle_events();
         if (!paused) {
             update_iterative();
         }
-        draw();
+        prepare_draw();
+        finish_draw();
+#endif
 
+        PROFILE_END_FRAME(world.profiler);
         auto clock_finished = std::chrono::high_resolution_clock::now();
 
 
@@ -136,17 +189,97 @@ private:
                         offset_x += event.motion.xrel;
                         offset_y += event.motion.yrel;
                     }
+                    if (event.motion.state & SDL_BUTTON(SDL_BUTTON_LEFT)) {
+                        use_tool(screen_to_world_x(event.motion.x), screen_to_world_y(event.motion.y));
+                    }
+                }
+                if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT) {
+                    start_tool(screen_to_world_x(event.button.x), screen_to_world_y(event.button.y));
                 }
             }
+            if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT) {
+                dragged = {};
+            }
         }
      }
 
    
+    float screen_to_world_x(float x) const { return (x - offset_x) / scale; }
+    float screen_to_world_y(float y) const { return (y - offset_y) / scale; }
+
+    // --- tools ---
+    // The mouse tools use the spatial queries of the spacemap, so they only touch the atoms under the brush.
+
+    void start_tool(float x, float y) {
+        tool_x = x;
+        tool_y = y;
+        if (tool == Tool::drag) {
+            dragged = world.handle(world.spacemap->nearest(x, y, brush_radius));
+        }
+        use_tool(x, y);
+    }
+
+    void use_tool(float x, float y) {
+        auto& params = world.params;
+        world_changed = true;
+        switch (tool) {
+            case Tool::drag:
+                if (auto atom = world.atom(dragged)) {
+                    world.wake(*atom);
+                    // it keeps the velocity of the mouse when let go
+                    atom->vx = x - atom->x;
+                    atom->vy = y - atom->y;
+                    atom->x = std::clamp(x, params.atom_radius, params.space_width - params.atom_radius);
+                    atom->y = std::clamp(y, params.atom_radius, params.space_height - params.atom_radius);
+                    world.spacemap->update_atom(atom);
+                }
+                break;
+            case Tool::erase:
+                world.remove_atoms(world.spacemap->atoms_in_radius(x, y, brush_radius, query_buffer));
+                break;
+            case Tool::paint:
+                // a few atoms per event, where there is room
+                for (int i=0;i<4;++i) {
+                    float angle = world.random.randf(0, 2*M_PI);
+                    float distance = brush_radius * std::sqrt(world.random.randf(0, 1));
+                    float px = x + distance * std::cos(angle);
+                    float py = y + distance * std::sin(angle);
+                    if (px < params.atom_radius || px > params.space_width - params.atom_radius) continue;
+                    if (py < params.atom_radius || py > params.space_height - params.atom_radius) continue;
+                    if (!world.spacemap->atoms_in_radius(px, py, params.atom_radius*2, query_buffer).empty()) continue;
+                    world.add_atom(px, py, paint_type, paint_state);
+                }
+                break;
+            case Tool::cut:
+                for (auto [i, j]: world.spacemap->bonds_crossing(tool_x, tool_y, x, y, params.bonding_end_distance, bond_buffer)) {
+                    auto& atom1 = world.atoms[i];
+                    auto& atom2 = world.atoms[j];
+                    world.wake(*atom1);
+                    world.wake(*atom2);
+                    world.remove_bond(world.make_atom_pair(atom1.get(), atom2.get()));
+                }
+                break;
+        }
+        tool_x = x;
+        tool_y = y;
+    }
+
     void update_iterative() {
         auto clock_start = std::chrono::high_resolution_clock::now();
 
+        if (world_changed) {
+            timeline.branch(world);
+            world_changed = false;
+        }
         for (int i=0;i<iterations_per_frame;++i) {
-            update();
+            // in the past, the recorded steps are replayed
+            if (world.step_count < timeline.last_step()) {
+                timeline.seek(world, world.step_count + 1);
+            }
+            else {
+                world.update();
+                timeline.record(world);
+            }
         }
         
         auto clock_end = std::chrono::high_resolution_clock::now();
@@ -154,151 +287,65 @@ private:
         debug_update_duration = duration.count();
     }
                
-    void update() {
-        debug_num_pairs_tested = 0;
-        debug_num_rules_tested = 0;
-        debug_num_rules_applied = 0;
-
-        float pair_distance = fmax(params.bonding_start_distance, params.atom_radius*2);
-        auto pairs = spacemap->get_pairs(pair_distance);
-
-        // try rules 
-        for (auto& pair: pairs) {
-            debug_num_pairs_tested++;
-            auto& atom1 = pair.first;
-            auto& atom2 = pair.second;
-            for (auto& rule: rules) {
-                debug_num_rules_tested ++;
-                if (match_rule(*rule, atom1, atom2)) {
-                    apply_rule(*rule, atom1, atom2);
-                    debug_num_rules_applied++;
-                
-                }
-                else if (match_rule(*rule, atom2, atom1)) {
-                    apply_rule(*rule, atom2, atom1);
-                    debug_num_rules_applied++;
-                }
-            }
-        }
-
-        using AtomPairBondPair = std::pair<const AtomPair,std::shared_ptr<Bond>>;
-        auto broken = [&](AtomPairBondPair& item) {
-            auto& bond = item.second;
-            float dx = bond->atom2->x - bond->atom1->x;
-            float dy = bond->atom2->y - bond->atom1->y;
-            float dist = sqrt(dx*dx + dy*dy);
-            return dist > params.bonding_end_distance;
-        };
-        std::vector<AtomPair> to_remove;
-        for (auto item: atompair2bond) {
-            if (broken(item)) {
-                item.second->atom1->state = 0;
-                item.second->atom2->state = 0;
-                to_remove.push_back(item.first);
-            }
-        };
-        for (auto& pair: to_remove) {
-            atompair2bond.erase(pair);
-        }
-
-        // enfore bonds
-        for (auto& item: atompair2bond) {
-            item.second->update();
-        }
-        
-        // collide
-        for (auto& pair: pairs) {
-            auto& atom1 = pair.first;
-            auto& atom2 = pair.second;
-            atom1->collide(*atom2);
-        }
-
-        // move atoms
-        for (auto& atom: atoms) {
-            atom->update();
-            spacemap->update_atom(atom);
+#ifdef SIMULATION_THREAD
+    // the simulation thread: the steps of a frame at a time, on request of frame()
+    void simulate() {
+        std::unique_lock<std::mutex> lock(world_mutex);
+        while (true) {
+            simulation_requested.wait(lock, [&]() { return simulating || quit; });
+            if (quit) return;
+            update_iterative();
+            simulating = false;
+            simulation_done.notify_one();
         }
     }
+#endif
 
-    void draw() {
+    // the part of drawing that needs the world: the user interface, and a copy of what is drawn of the world
+    void prepare_draw() {
     
         auto clock_start = std::chrono::high_resolution_clock::now();
 
         SDL_SetRenderDrawColor(renderer, 0,0,0,255);
         SDL_RenderClear(renderer);
         
-        imgui_start_frame();
-    
-        draw_world();
-        
-        SDL_RenderFlush(renderer);
-        
-        imgui_render_frame();
+        {
+            PROFILE_SCOPE(world.profiler, Phase::imgui);
+            imgui_start_frame();
+        }
+        scene.capture(world);
 
-        // log time
         auto clock_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float> duration = clock_end - clock_start;
         debug_draw_duration = duration.count();
-
     }
-    
-    void draw_world() {
 
-        int window_width, window_height;
-        SDL_GetWindowSize(window, &window_width, &window_height);
-        SDL_SetRenderDrawColor(renderer, 64,64,64,255);
-        SDL_FRect window_rect = {0, 0, (float)window_width, (float)window_height};
-        SDL_RenderFillRectF(renderer, &window_rect);
-        SDL_SetRenderDrawColor(renderer, 0,0,0,255);
-        SDL_FRect space_rect = {offset_x, offset_y, params.space_width*scale, params.space_height*scale};
-        SDL_RenderFillRectF(renderer, &space_rect);
+    void finish_draw() {
 
-        for (auto& atom: atoms) {
-                atom_renderer->draw(*atom, scale, offset_x, offset_y);
-        }
+        auto clock_start = std::chrono::high_resolution_clock::now();
 
-        for (auto& item: atompair2bond) {
-                item.second->draw(*renderer, scale, offset_x, offset_y);
+        {
+            PROFILE_SCOPE(world.profiler, Phase::render);
+            draw_world();
+            SDL_RenderFlush(renderer);
+        }
+        {
+            PROFILE_SCOPE(world.profiler, Phase::imgui);
+            imgui_render_frame();
         }
 
-    }
+        // log time
+        auto clock_end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float> duration = clock_end - clock_start;
+        debug_draw_duration += duration.count();
 
-    bool match_rule(const Rule& rule, const std::shared_ptr<const Atom>& atom1, const std::shared_ptr<const Atom>& atom2)
-    {
-        bool bonded = atompair2bond.contains(make_atom_pair(atom1.get(),atom2.get()));
-        return rule.match(atom1, atom2, bonded);
-    };
-    
-    void apply_rule(const Rule& rule, std::shared_ptr<Atom>& atom1, std::shared_ptr<Atom>& atom2)
-    {
-        atom1->state = rule.after_state1;
-        atom2->state = rule.after_state2;
-        bool bonded = atompair2bond.contains(make_atom_pair(atom1.get(),atom2.get()));
-        if (rule.after_bonded != bonded) {
-            if (rule.after_bonded) {
-                if (atom1->num_bonds >= params.max_bonds_per_atom) return;
-                if (atom2->num_bonds >= params.max_bonds_per_atom) return;
-                add_bond(atom1, atom2);
-            } else {
-                // 
-                atompair2bond.erase(make_atom_pair(atom1.get(),atom2.get()));
-            }
-        }
-    };
-    
-    AtomPair make_atom_pair(const Atom* atom1, const Atom* atom2)
-    {
-        const Atom* left = (atom1<atom2)?atom1:atom2;
-        const Atom* right = (atom1<atom2)?atom2:atom1;
-        return AtomPair(left,right);
     }
-
-    std::shared_ptr<Bond> add_bond( std::shared_ptr<Atom>& atom1, std::shared_ptr<Atom>& atom2) 
-    {
-        auto pair = make_atom_pair(atom1.get(),atom2.get());
-        auto bond = std::make_shared<Bond>(params,atom1,atom2);        
-        atompair2bond[pair]=bond;
-        return bond;
+    
+    // drawn the same way as exported frames, see FrameExporter
+    void draw_world() {
+        int window_width, window_height;
+        SDL_GetWindowSize(window, &window_width, &window_height);
+        scene.draw(*renderer, *atom_renderer, window_width, window_height, scale, offset_x, offset_y);
     }
 
     void imgui_setup() {
@@ -332,186 +379,483 @@ private:
 
             ImGui::SliderInt("Iterations per frame", &iterations_per_frame, 1, 100);
 
+            imgui_timeline();
+
             ImGui::SeparatorText("World");
 
             if (ImGui::Button("Restart")) {
-                restart();
+                dragged = {};
+                world.restart();
+                timeline.clear();
+                world_changed = true;
             }
 
-            int old_width = params.space_width;
-            int old_height = params.space_height;
+            int old_width = world.params.space_width;
+            int old_height = world.params.space_height;
             
             ImGui::SetNextItemWidth(100);    
-            ImGui::InputFloat("width", &params.space_width, 100, 1000.0f);
+            ImGui::InputFloat("width", &world.params.space_width, 100, 1000.0f);
             ImGui::SameLine();
             ImGui::SetNextItemWidth(100);    
-            ImGui::InputFloat("height", &params.space_height, 100, 1000.0f);
+            ImGui::InputFloat("height", &world.params.space_height, 100, 1000.0f);
+
+            if (old_width != world.params.space_width || old_height != world.params.space_height) {
+                world.resize();
+                world_changed = true;
+            }
 
-            if (old_width != params.space_width || old_height != params.space_height) {
-                resize();
+            static const char* boundary_items[] = { "Reflect", "Periodic", "Open" };
+            int boundary = static_cast<int>(world.params.boundary);
+            ImGui::SetNextItemWidth(100);
+            if (ImGui::Combo("Boundary", &boundary, boundary_items, IM_ARRAYSIZE(boundary_items))) {
+                world.params.boundary = static_cast<Boundary>(boundary);
+                world.resize();
+                world_changed = true;
             }
 
             ImGui::PushItemWidth(100);
-            for (int color=0;color<start_atoms.size();++color) {
-                std::string label = std::format("{:c}",'a' + color);
-                ImGui::SliderInt(label.c_str(), &start_atoms[color], 0, 1000);
-                if (color != 2 and color != 5) {
+            int num_start_types = world.start_atoms.size();
+            if (ImGui::SliderInt("Atom types", &num_start_types, 1, max_types)) {
+                world.start_atoms.resize(num_start_types, world.start_atoms.back());
+            }
+            for (int type=0;type<world.start_atoms.size();++type) {
+                std::string label = type_name(type);
+                ImGui::SliderInt(label.c_str(), &world.start_atoms[type], 0, 1000);
+                if (type % 3 != 2 && type != world.start_atoms.size()-1) {
                     ImGui::SameLine();
                 }
             }
+            static const char* layout_items[] = { "Random", "Grid" };
+            int layout = static_cast<int>(world.start_layout);
+            if (ImGui::Combo("Start layout", &layout, layout_items, IM_ARRAYSIZE(layout_items))) {
+                world.start_layout = static_cast<StartLayout>(layout);
+            }
+            if (ImGui::IsItemHovered()) ImGui::SetTooltip("Grid: without overlap, for dense worlds; molecules are always placed on the grid");
             ImGui::PopItemWidth(); 
+            imgui_molecules();
 
-            ImGui::SeparatorText("Rules");
+            ImGui::SeparatorText("Tools");
+
+            static const char* tool_items[] = { "Drag", "Erase", "Paint", "Cut bonds" };
+            int tool_index = static_cast<int>(tool);
+            ImGui::SetNextItemWidth(100);
+            if (ImGui::Combo("Left mouse button", &tool_index, tool_items, IM_ARRAYSIZE(tool_items))) {
+                tool = static_cast<Tool>(tool_index);
+            }
+            ImGui::SliderFloat("Brush radius", &brush_radius, 1.0f, 200.0f);
+            if (tool == Tool::paint) {
+                ImGui::PushItemWidth(50);
+                type_combo("type", paint_type, TypeChoice::types);
+                ImGui::SameLine();
+                ImGui::DragInt("state", &paint_state, 0.2f, 0, max_states-1);
+                ImGui::PopItemWidth();
+            }
+
+            ImGui::SeparatorText("Sources and sinks");
+            std::string regions_before = regions_text();
+            imgui_regions();
+            if (regions_text() != regions_before) world_changed = true;
 
-            static const char* atom_type_items[] = { "a","b","c","d","e","f", "X", "Y"};
-            static const char* atom_state_items[] = { "0","1","2","3","4","5","6","7","8","9"}; 
-            auto atom_type_from_index = [&](int index)->char {return atom_type_items[index][0];};
-            auto atom_type_to_index = [&](char type)->int {
-                 for (int i=0;i<IM_ARRAYSIZE(atom_type_items);++i) {
-                    if (atom_type_items[i][0]==type) return i;
-                 }
-                 return 0;
-            };
+            ImGui::SeparatorText("Rules");
 
             // new rule
             ImGui::PushItemWidth(50);
             static int atom_type1 = 0;
-            ImGui::Combo("##type1", &atom_type1, atom_type_items, IM_ARRAYSIZE(atom_type_items));     
+            type_combo("##type1", atom_type1, TypeChoice::wildcards);
             ImGui::SameLine();         
             static int before_state_1 = 0;
-            ImGui::Combo("##before1", &before_state_1, atom_state_items, IM_ARRAYSIZE(atom_state_items));
+            ImGui::DragInt("##before1", &before_state_1, 0.2f, 0, max_states-1);
             ImGui::SameLine();
             static bool bonded_before = false;
             ImGui::Checkbox("##bonded_before", &bonded_before);
             ImGui::SameLine();
             static int atom_type2 = 0;
-            ImGui::Combo("##type2", &atom_type2, atom_type_items, IM_ARRAYSIZE(atom_type_items));    
+            type_combo("##type2", atom_type2, TypeChoice::wildcards);
             ImGui::SameLine();      
             static int before_state_2 = 0;
-            ImGui::Combo("##before2", &before_state_2, atom_state_items, IM_ARRAYSIZE(atom_state_items));
+            ImGui::DragInt("##before2", &before_state_2, 0.2f, 0, max_states-1);
             ImGui::SameLine(); 
             ImGui::Text("->");
             ImGui::SameLine();  
             static int after_state_1 = 0;
-            ImGui::Combo("##after1", &after_state_1, atom_state_items, IM_ARRAYSIZE(atom_state_items));
+            ImGui::DragInt("##after1", &after_state_1, 0.2f, 0, max_states-1);
             ImGui::SameLine();
             static bool bonded_after = true;
             ImGui::Checkbox("##bonded_after", &bonded_after);
             ImGui::SameLine();
             static int after_state_2 = 0;
-            ImGui::Combo("##after2", &after_state_2, atom_state_items, IM_ARRAYSIZE(atom_state_items));
+            ImGui::DragInt("##after2", &after_state_2, 0.2f, 0, max_states-1);
+            ImGui::SameLine();
+            static float rate = 1;
+            ImGui::SliderFloat("##rate", &rate, 0.0f, 1.0f, "@%.2f");
             ImGui::PopItemWidth();
 
 
             if (ImGui::Button("Add Rule")) {
-                rules.push_back(std::make_unique<Rule>(atom_type_from_index(atom_type1), before_state_1, bonded_before,
-                                                       atom_type_from_index(atom_type2), before_state_2, 
+                world.rules.push_back(std::make_unique<Rule>(atom_type1, before_state_1, bonded_before,
+                                                       atom_type2, before_state_2, 
                                                        after_state_1, bonded_after, after_state_2));
+                world.rules.back()->rate = rate;
+                world.wake_all();
+                world_changed = true;
             }
 
-            for (auto& rule: rules) {
+            for (auto& rule: world.rules) {
                 ImGui::PushID(rule.get());
                 ImGui::PushItemWidth(50);
 
                 // delete button
                 if (ImGui::Button("X")) {
-                    atom_type1 = atom_type_to_index(rule->atom_type1);
-                    atom_type2 = atom_type_to_index(rule->atom_type2);
+                    atom_type1 = rule->atom_type1;
+                    atom_type2 = rule->atom_type2;
                     before_state_1 = rule->before_state1;
                     before_state_2 = rule->before_state2;
                     after_state_1 = rule->after_state1;
                     after_state_2 = rule->after_state2;
                     bonded_before = rule->before_bonded;
                     bonded_after = rule->after_bonded;
-                    rules.erase(std::remove(rules.begin(), rules.end(), rule), rules.end());
+                    rate = rule->rate;
+                    world.rules.erase(std::remove(world.rules.begin(), world.rules.end(), rule), world.rules.end());
+                    world.wake_all();
+                    world_changed = true;
                     ImGui::PopID();
                     ImGui::PopItemWidth();
                     break;
                 }
                 ImGui::SameLine();
                 ImGui::Text("%s",rule->toText().c_str());                  
+                if (world.rule_stats_interval > 0) {
+                    ImGui::SameLine();
+                    ImGui::TextDisabled("%.0f tests, %ld hits, %ld blocked, %.1f%% time", 
+                        rule->stats.attempts, rule->stats.hits, rule->stats.blocked, world.rule_time_share(*rule) * 100);
+                }
                 ImGui::PopItemWidth();
                 ImGui::PopID();
             }
+
+            if (ImGui::Checkbox("Stochastic rules", &world.stochastic_rules)) world_changed = true;
+            if (ImGui::IsItemHovered()) ImGui::SetTooltip("Fire matching rules in random order, on average rate times per step");
+            ImGui::PushItemWidth(100);
+            ImGui::SliderInt("Rule statistics sampling", &world.rule_stats_interval, 0, 256, "1 in %d pairs");
+            ImGui::PopItemWidth();
+            if (ImGui::Button("Reset statistics")) {
+                world.reset_rule_stats();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Export statistics")) {
+                std::ofstream file("rule_stats.csv");
+                world.write_rule_stats(file);
+            }
         
+            auto params_before = world.params;
             if (ImGui::CollapsingHeader("Physics Parameters")) {
-                ImGui::SliderFloat("Temperature", &params.temp, 0.0f, 1.0f);
-                ImGui::SliderFloat("Friction", &params.friction, 0.0f, 1.0f);
-                ImGui::SliderFloat("Collision Elasticity", &params.collision_elasticity, 0.0f, 1.0f);
-                //ImGui::SliderFloat("Atom Radius", &params.atom_radius, 1.0f, 100.0f);
-                ImGui::SliderFloat("Bonding Distance", &params.bonding_distance, 1.0f, 100.0f);
-                ImGui::SliderFloat("Bonding Start Distance", &params.bonding_start_distance, 1.0f, 100.0f);
-                ImGui::SliderFloat("Bonding End Distance", &params.bonding_end_distance, 1.0f, 100.0f);
-                ImGui::SliderFloat("Bonding Strength", &params.bonding_strength, 0.0f, 1.0f);
-                ImGui::SliderInt("Max bonds per atom", &params.max_bonds_per_atom, 0,16);
+                static const char* integrator_items[] = { "Euler", "Velocity Verlet" };
+                int integrator = static_cast<int>(world.params.integrator);
+                if (ImGui::Combo("Integrator", &integrator, integrator_items, IM_ARRAYSIZE(integrator_items))) {
+                    world.params.integrator = static_cast<Integrator>(integrator);
+                }
+                ImGui::SliderFloat("Time step", &world.params.dt, 0.1f, 4.0f);
+                if (world.params.integrator == Integrator::verlet) {
+                    ImGui::SliderInt("Bond substeps", &world.params.bond_substeps, 1, 16);
+                }
+                ImGui::SliderFloat("Temperature", &world.params.temp, 0.0f, 1.0f);
+                ImGui::SliderFloat("Friction", &world.params.friction, 0.0f, 1.0f);
+                ImGui::SliderFloat("Collision Elasticity", &world.params.collision_elasticity, 0.0f, 1.0f);
+                //ImGui::SliderFloat("Atom Radius", &world.params.atom_radius, 1.0f, 100.0f);
+                ImGui::SliderFloat("Bonding Distance", &world.params.bonding_distance, 1.0f, 100.0f);
+                ImGui::SliderFloat("Bonding Start Distance", &world.params.bonding_start_distance, 1.0f, 100.0f);
+                ImGui::SliderFloat("Bonding End Distance", &world.params.bonding_end_distance, 1.0f, 100.0f);
+                ImGui::SliderFloat("Bonding Strength", &world.params.bonding_strength, 0.0f, 1.0f);
+                ImGui::SliderInt("Max bonds per atom", &world.params.max_bonds_per_atom, 0,16);
             }
+            if (world.params != params_before) world_changed = true;
         
             if (ImGui::CollapsingHeader("Statistics")) {
-                ImGui::LabelText("Number of atoms", "%d", (int)atoms.size());
-                ImGui::LabelText("Number of bonds", "%d", (int)atompair2bond.size());
-                ImGui::LabelText("Number of pairs tested", "%d", debug_num_pairs_tested);
-                ImGui::LabelText("Number of rules tested", "%d", debug_num_rules_tested);
-                ImGui::LabelText("Number of rules applied", "%d", debug_num_rules_applied);
+                // these walk all atoms, so they are refreshed at most once a second
+                auto now = std::chrono::high_resolution_clock::now();
+                if (now - statistics_clock >= std::chrono::seconds(1)) {
+                    statistics_clock = now;
+                    statistics_hash = world.state_hash();
+                    statistics_stride = world.mean_atom_stride();
+                    statistics_memory = world.memory_usage();
+                    statistics_atoms = world.atoms.size();
+                    statistics_bonds = world.bonds.size();
+                }
+                ImGui::LabelText("Number of atoms", "%d", (int)world.atoms.size());
+                ImGui::LabelText("Number of bonds", "%d", (int)world.bonds.size());
+                ImGui::LabelText("Number of pairs tested", "%d", world.debug_num_pairs_tested);
+                ImGui::LabelText("Number of rules tested", "%d", world.debug_num_rules_tested);
+                ImGui::LabelText("Number of rules applied", "%d", world.debug_num_rules_applied);
                 ImGui::LabelText("Update duration (ms)", "%f", debug_update_duration * 1000);
+                ImGui::LabelText("Simulated time", "%.0f", world.time);
+                ImGui::LabelText("State hash", "%016llx", (unsigned long long)statistics_hash);
+                ImGui::LabelText("Simulated time per second", "%.0f", debug_update_duration > 0 ? iterations_per_frame * world.params.dt / debug_update_duration : 0);
                 ImGui::LabelText("Draw duration (ms)", "%f", debug_draw_duration * 1000);
                 ImGui::LabelText("Average FPS", "%f", debug_average_fps);
                 ImGui::SliderInt("Minimum Frame Time (ms)", &minimum_frame_time_ms, 0, 16, "%d ms");
+                ImGui::LabelText("Atom reorders", "%d", world.debug_num_reorders);
+                ImGui::LabelText("Mean atom stride (bytes)", "%.0f", statistics_stride);
+                ImGui::LabelText("Memory (MB)", "%.1f", statistics_memory.total() / 1048576.0);
+                ImGui::LabelText("Bytes per atom", "%.0f", statistics_atoms ? (double)statistics_memory.atoms / statistics_atoms : 0.0);
+                ImGui::LabelText("Bytes per bond", "%.0f", statistics_bonds ? (double)statistics_memory.bonds / statistics_bonds : 0.0);
+                ImGui::LabelText("Spacemap (MB)", "%.1f", statistics_memory.spacemap / 1048576.0);
+                // these change the course of the simulation too
+                if (ImGui::SliderFloat("Reorder threshold", &world.reorder_threshold, 0.0f, 4.0f, "%.2f x atoms")) world_changed = true;
+                if (ImGui::Checkbox("Sleep quiet atoms", &world.sleeping_enabled)) world_changed = true;
+                if (ImGui::SliderFloat("Sleep velocity", &world.sleep_velocity, 0.0f, 1.0f)) world_changed = true;
+                if (ImGui::SliderFloat("Sleep tolerance", &world.sleep_tolerance, 0.0f, 32.0f)) world_changed = true;
+                ImGui::LabelText("Sleeping atoms", "%d", world.num_sleeping);
+                ImGui::LabelText("Sleeping islands", "%d", (int)world.islands.size());
+            }
+            if (ImGui::CollapsingHeader("Molecules")) {
+                imgui_clusters();
             }
+            if (ImGui::CollapsingHeader("Population")) {
+                imgui_population();
+            }
+#ifdef PROFILER
+            if (ImGui::CollapsingHeader("Profiler")) {
+                imgui_profiler();
+            }
+#endif
         }
         ImGui::End();
     }
 
-    void imgui_render_frame() {
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        SDL_GL_SwapWindow(window);
+    // scrub through the recorded steps; see Timeline
+    void imgui_timeline() {
+        int step = world.step_count;
+        int target = step;
+        ImGui::SetNextItemWidth(300);
+        ImGui::SliderInt("Step", &target, timeline.first(), timeline.last_step());
+        if (ImGui::Button("Step back")) target = step - 1;
+        ImGui::SameLine();
+        if (ImGui::Button("Step forward")) target = step + 1;
+        if (target != step) {
+            paused = true;
+            if (world_changed) {
+                timeline.branch(world);
+                world_changed = false;
+            }
+            timeline.seek(world, std::clamp(target, timeline.first(), timeline.last_step()));
+            dragged = {};
+        }
+        if (world.step_count < timeline.last_step()) {
+            ImGui::SameLine();
+            // the recorded future is dropped, and what happens from here on is recorded instead
+            if (ImGui::Button("Branch from here")) {
+                timeline.branch(world);
+            }
+            ImGui::SameLine();
+            ImGui::Text("%d steps behind", timeline.last_step() - world.step_count);
+        }
+        ImGui::PushItemWidth(100);
+        ImGui::SliderInt("Keyframe interval", &timeline.keyframe_interval, 10, 1000);
+        ImGui::SameLine();
+        int max_megabytes = timeline.max_bytes >> 20;
+        if (ImGui::SliderInt("Memory (MB)", &max_megabytes, 16, 4096)) {
+            timeline.max_bytes = (size_t)max_megabytes << 20;
+        }
+        ImGui::PopItemWidth();
+        ImGui::Checkbox("Compact keyframes", &timeline.compact);
+        if (ImGui::IsItemHovered()) ImGui::SetTooltip("Smaller keyframes, but steps replayed from them differ slightly from the recorded ones");
+        ImGui::SameLine();
+        ImGui::Text("%d keyframes, %.1f MB", timeline.size(), timeline.bytes() / 1048576.0);
     }
 
-    void resize() {
-        spacemap = std::make_unique<SpaceMap>(params.space_width, params.space_height, params.atom_radius*2, params.atom_radius*2);
-        std::vector<AtomPair> to_remove;
+    // the types of the world, and after them the rule wildcards X and Y, or * for regions
+    enum class TypeChoice { types, wildcards, any };
 
-        for (auto& item: atompair2bond) {
-            auto& bond = item.second;
-            if (bond->atom1->off_world() || bond->atom2->off_world()) {
-                to_remove.push_back(item.first);        
+    void type_combo(const char* label, int& type, TypeChoice choice) {
+        int num_types = std::max<int>(world.start_atoms.size(), world.population.num_types);
+        if (type >= 0) num_types = std::max(num_types, type + 1);
+        auto name = [&](int t) {
+            if (t >= 0) return type_name(t);
+            if (choice == TypeChoice::any) return std::string("*");
+            return Rule::type_text(t);
+        };
+        if (ImGui::BeginCombo(label, name(type).c_str())) {
+            std::vector<int> items;
+            for (int t=0;t<num_types;++t) items.push_back(t);
+            if (choice == TypeChoice::wildcards) items.insert(items.end(), {Rule::type_x, Rule::type_y});
+            if (choice == TypeChoice::any) items.push_back(Region::any_type);
+            for (int t: items) {
+                if (ImGui::Selectable(name(t).c_str(), t == type)) type = t;
             }
+            ImGui::EndCombo();
         }
-        for (auto& pair: to_remove) {
-            atompair2bond.erase(pair);
+    }
+
+    void imgui_molecules() {
+        int to_delete = -1;
+        for (int i=0;i<world.start_molecules.size();++i) {
+            ImGui::PushID(i);
+            if (ImGui::Button("X")) to_delete = i;
+            ImGui::SameLine();
+            ImGui::Text("%s", world.start_molecules[i].toText().c_str());
+            ImGui::PopID();
         }
-        
-        auto off_world = [&](std::shared_ptr<Atom> atom){return atom->off_world();};
-            
-        atoms.erase(std::remove_if(atoms.begin(),atoms.end(),off_world),atoms.end());
-        for (auto& atom: atoms) {
-            atom->spacemap_index = -1;
-            spacemap->update_atom(atom);
+        if (to_delete >= 0) {
+            world.start_molecules.erase(world.start_molecules.begin() + to_delete);
         }
+        static char molecule_text[64] = "chain a0b0c0 10";
+        ImGui::SetNextItemWidth(200);
+        ImGui::InputText("##molecule", molecule_text, sizeof(molecule_text));
+        ImGui::SameLine();
+        auto molecule = MoleculeTemplate::fromText(molecule_text);
+        if (!molecule) ImGui::BeginDisabled();
+        if (ImGui::Button("Add molecules") && molecule) world.start_molecules.push_back(*molecule);
+        if (!molecule) ImGui::EndDisabled();
+        if (ImGui::IsItemHovered()) ImGui::SetTooltip("Chains or rings of atoms at the next restart, e.g. chain a0b0c0 10, ring a0a0a0a0 5");
     }
-    
-    void restart() {
-        atoms.clear();
-        atompair2bond.clear();
 
-        // new spacemap for atom size and world size
-        spacemap = std::make_unique<SpaceMap>(params.space_width, params.space_height, params.atom_radius*2, params.atom_radius*2);
-        // create random atoms
-        for (int color=0;color<6;++color) {
-            for (int i=0;i<start_atoms[color];++i) {
-                float x=randf(0,params.space_width);
-                float y=randf(0,params.space_height);
-                char type = 'a' + color;
-                atoms.push_back(std::make_shared<Atom>(params,x,y,type,0));
-                spacemap->update_atom(atoms.back());
+    std::string regions_text() const {
+        std::string text;
+        for (auto& region: world.regions) {
+            text += region.toText() + "\n";
+        }
+        return text;
+    }
+
+    void imgui_regions() {
+        static const char* kind_items[] = { "Emit", "Absorb" };
+        int to_delete = -1;
+        for (int i=0;i<world.regions.size();++i) {
+            auto& region = world.regions[i];
+            ImGui::PushID(i);
+            ImGui::PushItemWidth(60);
+            int kind = static_cast<int>(region.kind);
+            if (ImGui::Combo("##kind", &kind, kind_items, IM_ARRAYSIZE(kind_items))) {
+                region.kind = static_cast<Region::Kind>(kind);
+                if (region.kind == Region::Kind::emitter && region.type == Region::any_type) region.type = 0;
             }
+            ImGui::SameLine();
+            type_combo("##type", region.type, region.kind == Region::Kind::emitter ? TypeChoice::types : TypeChoice::any);
+            if (region.kind == Region::Kind::emitter) {
+                ImGui::SameLine();
+                ImGui::DragInt("##state", &region.state, 0.2f, 0, max_states-1);
+                ImGui::SameLine();
+                ImGui::SliderFloat("##rate", &region.rate, 0.0f, 10.0f, "%.2f/step");
+            }
+            ImGui::PopItemWidth();
+            ImGui::SameLine();
+            if (ImGui::Button("Delete")) to_delete = i;
+            ImGui::DragFloat4("x y w h", &region.x, 1.0f, 0.0f, std::max(world.params.space_width, world.params.space_height));
+            ImGui::Text("%s %ld atoms", region.kind == Region::Kind::emitter ? "emitted" : "absorbed", region.count);
+            ImGui::PopID();
+        }
+        if (to_delete >= 0) {
+            world.regions.erase(world.regions.begin() + to_delete);
+        }
+        if (ImGui::Button("Add source")) {
+            world.regions.push_back(Region{Region::Kind::emitter, 0, 0, 100, world.params.space_height});
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Add sink")) {
+            world.regions.push_back(Region{Region::Kind::absorber, world.params.space_width - 100, 0, 100, world.params.space_height, Region::any_type});
         }
+        ImGui::LabelText("Pooled atoms", "%d / %d", world.atom_pool->size(), world.atom_pool->capacity());
+    }
+
+    void imgui_clusters() {
+        auto& clusters = world.clusters;
+        int largest = clusters.largest();
+        ImGui::LabelText("Number of molecules", "%d", clusters.num_clusters);
+        ImGui::LabelText("Largest molecule", "%d atoms", largest);
+        // histogram of molecule sizes, from 2 atoms
+        static std::vector<float> histogram;
+        histogram.assign(clusters.size_histogram.begin() + std::min(2, largest+1), clusters.size_histogram.begin() + largest + 1);
+        ImGui::PlotHistogram("Molecule sizes", histogram.data(), histogram.size(), 0, "from 2 atoms", 0.0f, FLT_MAX, ImVec2(0, 60));
+        // this walks all atoms, so only while the panel is open, and at most once a second unless
+        // the minimum size changes
+        static int min_size = 2;
+        bool min_size_changed = ImGui::SliderInt("Minimum size", &min_size, 1, 32);
+        auto now = std::chrono::high_resolution_clock::now();
+        if (min_size_changed || now - signatures_clock >= std::chrono::seconds(1)) {
+            signatures_clock = now;
+            signatures = clusters.signature_counts(world.atoms, min_size);
+        }
+        if (ImGui::BeginTable("signatures", 2)) {
+            ImGui::TableSetupColumn("Composition");
+            ImGui::TableSetupColumn("Count");
+            ImGui::TableHeadersRow();
+            for (int i=0;i<signatures.size() && i<20;++i) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(signatures[i].first.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%d", signatures[i].second);
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    void imgui_population() {
+        auto& population = world.population;
+        auto& history = world.population_history;
+        ImGui::SliderInt("Sample interval", &world.population_interval, 0, 100, "%d steps");
+        static int plot_state = -1;
+        ImGui::SliderInt("State", &plot_state, -1, population.num_states-1, plot_state < 0 ? "all" : "%d");
+        static std::vector<float> series;
+        for (int type=0;type<population.num_types;++type) {
+            if (population.atoms(type) == 0 && type >= world.start_atoms.size()) continue;
+            history.atom_series(type, plot_state, series);
+            int now = plot_state < 0 ? population.atoms(type) : population.atoms(type, plot_state);
+            std::string label = type_name(type);
+            std::string overlay = std::to_string(now);
+            ImGui::PlotLines(label.c_str(), series.data(), series.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 40));
+        }
+        if (ImGui::TreeNode("Bonds")) {
+            for (int bond_type=0;bond_type<population.num_bond_types();++bond_type) {
+                if (population.bond_counts[bond_type] == 0) continue;
+                history.bond_series(bond_type, series);
+                std::string label = Population::bond_type_name(bond_type);
+                std::string overlay = std::to_string(population.bond_counts[bond_type]);
+                ImGui::PlotLines(label.c_str(), series.data(), series.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+            ImGui::TreePop();
+        }
+    }
+
+#ifdef PROFILER
+    void imgui_profiler() {
+        static std::vector<float> history;
+        for (int i=0;i<Profiler::num_phases;++i) {
+            Phase phase = static_cast<Phase>(i);
+            world.profiler.history(phase, history);
+            float average = 0;
+            for (float value: history) average += value;
+            if (!history.empty()) average /= history.size();
+            std::string overlay = std::format("{:.3f} ms", average);
+            ImGui::PlotLines(phase_names[i], history.data(), history.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 40));
+        }
+        if (ImGui::Button("Export Chrome trace")) {
+            world.profiler.export_chrome_trace("organicsoup_trace.json");
+        }
+    }
+#endif
+
+    void imgui_render_frame() {
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        SDL_GL_SwapWindow(window);
     }
 
     // ----- variables ------
 
     bool quit = false;
     bool paused = false;
+
+    enum class Tool { drag, erase, paint, cut };
+    Tool tool = Tool::drag;
+    float brush_radius = 20.0f;     // in world units; also the picking distance for dragging
+    int paint_type = 0;
+    int paint_state = 0;
+    AtomHandle dragged;
+    float tool_x = 0;               // last position of the tool
+    float tool_y = 0;
+    std::vector<int> query_buffer;
+    std::vector<std::pair<int,int>> bond_buffer;
     int minimum_frame_time_ms = 16; // ms, ~60 fps
     int iterations_per_frame = 1; // how many physics iterations per frame
 
@@ -521,32 +865,40 @@ private:
     float offset_x = 0.0f;
     float offset_y = 0.0f;
 
-    // parameters 
-    std::array<int,6> start_atoms = {16,16,16,16,16,16};
-    PhysicsParameters params;
-
     // data
-    std::unique_ptr<SpaceMap> spacemap;
+    World world;
+    Scene scene;                    // what is drawn of the world
+    Timeline timeline;
+    bool world_changed = false;     // by the user since the last step, see Timeline::branch()
+
+#ifdef SIMULATION_THREAD
+    // e.g. in the multithreaded web build; not with PROFILER, see the #error at the top
+    std::thread simulation_thread;
+    std::mutex world_mutex;
+    std::condition_variable simulation_requested;
+    std::condition_variable simulation_done;
+    bool simulating = false;        // steps were requested and are not done yet
+#endif
     std::unique_ptr<AtomRenderer> atom_renderer;
-    std::vector<std::shared_ptr<Atom>> atoms;
-    //std::vector<std::shared_ptr<Bond>> bonds;
-    std::vector<std::unique_ptr<Rule>> rules;
-
-    // TODO: instead of this map, we could use an unordered set of bonds with a proper hash and compare for bonds...
-    std::unordered_map<AtomPair,std::shared_ptr<Bond>> atompair2bond;
-
-    
    
     // Performance variables
     // TODO: rename debug->performance; or put in a struct
-    int debug_num_pairs_tested = 0;
-    int debug_num_rules_tested = 0;
-    int debug_num_rules_applied = 0;
     float debug_draw_duration = 0;
     float debug_update_duration = 0;
     float debug_average_fps = 0;
     std::chrono::time_point<std::chrono::high_resolution_clock> last_frame_clock;
+    // the statistics that walk all atoms, as of statistics_clock
+    std::chrono::time_point<std::chrono::high_resolution_clock> statistics_clock;
+    uint64_t statistics_hash = 0;
+    float statistics_stride = 0;
+    World::MemoryUsage statistics_memory;
+    size_t statistics_atoms = 0;
+    size_t statistics_bonds = 0;
+    // the molecules per composition, as of signatures_clock
+    std::chrono::time_point<std::chrono::high_resolution_clock> signatures_clock;
+    std::vector<std::pair<std::string,int>> signatures;
 };
+#endif
 
 #ifdef WEBAPP
 #include <emscripten/emscripten.h>
@@ -579,8 +931,427 @@ int main(int argc, char* argv[]) {
 
 }
 #else
+
+// the same parameters, settings, rules and seed as source; restart to get the same atoms too
+void configure_like(World& world, const World& source) {
+    world.params = source.params;
+    world.start_atoms = source.start_atoms;
+    world.start_molecules = source.start_molecules;
+    world.start_layout = source.start_layout;
+    world.start_threads = source.start_threads;
+    world.threads = source.threads;
+    world.random = source.random;
+    world.regions = source.regions;
+    world.reorder_threshold = source.reorder_threshold;
+    world.sleeping_enabled = source.sleeping_enabled;
+    world.stochastic_rules = source.stochastic_rules;
+    world.rules.clear();
+    for (auto& rule: source.rules) {
+        world.rules.push_back(std::make_unique<Rule>(*rule));
+    }
+}
+
+// Step the world and a candidate, a copy with some settings changed, in lockstep and report
+// the first step at which they differ; see DifferentialChecker.
+// With reload_interval, the candidate is saved and loaded again every that many steps.
+int run_headless_check(const World& world, const std::vector<std::pair<std::string,float>>& settings,
+                       float tolerance, int reload_interval, int steps) {
+    World reference;
+    World candidate;
+    configure_like(reference, world);
+    configure_like(candidate, world);
+    for (auto& [name, value]: settings) {
+        if (!candidate.set(name, value)) {
+            std::cerr << "unknown setting " << name << "\n";
+            return 1;
+        }
+    }
+    reference.restart();
+    candidate.restart();
+
+    DifferentialChecker checker;
+    checker.tolerance = tolerance;
+    World::Snapshot snapshot;
+    auto divergence = checker.compare(reference, candidate);
+    for (int i=0;i<steps && !divergence;++i) {
+        reference.update();
+        candidate.update();
+        if (reload_interval > 0 && candidate.step_count % reload_interval == 0) {
+            candidate.save(snapshot);
+            candidate.load(snapshot);
+        }
+        divergence = checker.compare(reference, candidate);
+    }
+    if (!divergence) {
+        std::cout << "no difference in " << steps << " steps, state hash "
+                  << std::hex << reference.state_hash() << std::dec << "\n";
+        return 0;
+    }
+    std::cout << "diverged at step " << divergence->step << ", " << divergence->num_atoms << " atoms differ\n";
+    for (auto& detail: divergence->details) {
+        std::cout << "  " << detail << "\n";
+    }
+    return 2;
+}
+
+// Run the world as num_domains domains, in this process or in one process each;
+// both give the same atoms, which are written to dump_filename, one per line.
+// With check, the whole world is run too, and its atoms must be the same.
+int run_headless_domains(const World& world, int num_domains, bool processes, bool check, int steps, const std::string& dump_filename) {
+    auto setup = [&](World& domain_world) {
+        configure_like(domain_world, world);
+    };
+    auto clock_start = std::chrono::high_resolution_clock::now();
+    DomainResult result;
+    try {
+        result = processes ? run_domain_processes(num_domains, steps, setup) : run_domains(num_domains, steps, setup);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    auto clock_end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float> duration = clock_end - clock_start;
+
+    std::cout << steps << " steps in " << duration.count() << " s, "
+              << steps / duration.count() << " steps/s, "
+              << num_domains << (processes ? " processes, " : " domains, ")
+              << result.atoms.size() << " atoms, "
+              << result.bonds << " bonds\n";
+
+    int difference = -1;
+    if (check) {
+        DomainResult whole = run_whole(steps, setup);
+        difference = first_difference(whole, result);
+        if (difference < 0) {
+            std::cout << "the same as the whole world\n";
+        }
+        else if (difference < (int)std::min(whole.atoms.size(), result.atoms.size())) {
+            auto& expected = whole.atoms[difference];
+            auto& atom = result.atoms[difference];
+            std::cout << "differs from the whole world: atom " << atom.id << " at (" << atom.x << ", " << atom.y
+                      << "), atom " << expected.id << " at (" << expected.x << ", " << expected.y << ") in the whole world\n";
+        }
+        else {
+            std::cout << "differs from the whole world: " << whole.atoms.size() << " atoms, " << whole.bonds << " bonds in the whole world\n";
+        }
+    }
+
+    if (!dump_filename.empty()) {
+        std::ofstream file(dump_filename);
+        file << "id,type,state,x,y\n";
+        file.precision(9);
+        for (auto& atom: result.atoms) {
+            file << atom.id << "," << type_name(key_type(atom.key)) << "," << key_state(atom.key) << "," << atom.x << "," << atom.y << "\n";
+        }
+    }
+    return difference < 0 ? 0 : 2;
+}
+
+// Run the world as a CompactWorld, which keeps the atoms and bonds in a CompactState between
+// steps; the atoms are placed straight into it, so there is never a World of them.
+int run_headless_compact(World& world, int steps, const std::string& hash_log_filename) {
+    auto restart_start = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<CompactWorld> compact;
+    try {
+        compact = std::make_unique<CompactWorld>(world);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    std::chrono::duration<float> restart_duration = std::chrono::high_resolution_clock::now() - restart_start;
+    std::cout << compact->num_atoms() << " atoms and " << compact->num_bonds() << " bonds placed in " << restart_duration.count() * 1000 << " ms\n";
+
+    std::ofstream hash_log;
+    if (!hash_log_filename.empty()) {
+        hash_log.open(hash_log_filename);
+    }
+    auto clock_start = std::chrono::high_resolution_clock::now();
+    for (int i=0;i<steps;++i) {
+        compact->update();
+        if (hash_log.is_open()) hash_log << std::dec << compact->state.step_count << " " << std::hex << compact->state_hash() << "\n";
+    }
+    std::chrono::duration<float> duration = std::chrono::high_resolution_clock::now() - clock_start;
+
+    std::cout << steps << " steps in " << duration.count() << " s, "
+              << steps / duration.count() << " steps/s, "
+              << compact->num_atoms() << " atoms, "
+              << compact->num_bonds() << " bonds, compact state hash "
+              << std::hex << compact->state_hash() << std::dec << "\n";
+    size_t bytes = compact->state.bytes();
+    size_t bond_bytes = compact->state.bonds.size() * sizeof(uint32_t);
+    std::cout << "memory " << bytes / 1048576.0 << " MB, "
+              << (compact->num_atoms() == 0 ? 0 : (bytes - bond_bytes) / compact->num_atoms()) << " bytes per atom, "
+              << (compact->num_bonds() == 0 ? 0 : bond_bytes / compact->num_bonds()) << " bytes per bond; "
+              << "scratch of a step " << compact->scratch_bytes() / 1048576.0 << " MB\n";
+    return 0;
+}
+
+// Run the simulation without a window, for example:
+//   organicsoup --headless --rules rules.txt --steps 10000 --rule-stats stats.csv
+// or run a parameter sweep, see ensemble.h:
+//   organicsoup --headless --ensemble sweep.txt
+// or export a frame every 10 steps as PNG files, or as raw video, without a display:
+//   organicsoup --headless --rules rules.txt --frames frame%05d.png --video - | ffmpeg -f rawvideo ...
+// or check that a setting doesn't change the outcome, see checker.h:
+//   organicsoup --headless --rules rules.txt --check-set reorder_threshold=0 --check-tolerance 0
+// or split the world into strips, each in a process of its own, see domain.h:
+//   organicsoup --headless --rules rules.txt --domains 4 --processes --domain-check --domain-dump atoms.csv
+// or serve live metrics for Prometheus while it runs, see metrics.h:
+//   organicsoup --headless --rules rules.txt --steps 1000000 --metrics-port 9100
+// or run a world too large for memory in compact form, see compactworld.h:
+//   organicsoup --headless --rules rules.txt --width 40000 --height 40000 --atoms 200000 --compact
+int run_headless(int argc, char* argv[]) {
+    World world;
+    int steps = 1000;
+    std::string rule_stats_filename;
+    std::string ensemble_filename;
+    std::string population_filename;
+    bool compact_world = false;
+    int num_domains = 0;
+    bool domain_processes = false;
+    bool domain_check = false;
+    std::string domain_dump_filename;
+    bool check = false;
+    std::vector<std::pair<std::string,float>> check_settings;
+    float check_tolerance = 0;
+    int check_reload_interval = 0;
+    std::string hash_log_filename;
+#ifndef HEADLESS
+    FrameExporter::Options export_options;
+    int frame_interval = 10;
+#endif
+    int metrics_port = 0;
+    std::string metrics_socket;
+    double metrics_interval = 1.0;
+    
+    for (int i=1;i<argc;++i) {
+        std::string arg = argv[i];
+        bool has_value = i+1 < argc;
+        if (arg == "--headless") continue;
+        else if (arg == "--steps" && has_value) steps = std::stoi(argv[++i]);
+        else if (arg == "--seed" && has_value) world.random.seed(std::stoull(argv[++i]));
+        else if (arg == "--width" && has_value) world.params.space_width = std::stof(argv[++i]);
+        else if (arg == "--height" && has_value) world.params.space_height = std::stof(argv[++i]);
+        else if (arg == "--atoms" && has_value) world.start_atoms.assign(world.start_atoms.size(), std::stoi(argv[++i]));
+        else if (arg == "--layout" && has_value) {
+            std::string layout = argv[++i];
+            if (layout == "random") world.start_layout = StartLayout::random;
+            else if (layout == "grid") world.start_layout = StartLayout::grid;
+            else {
+                std::cerr << "unknown layout " << layout << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--molecules" && has_value) {
+            if (!world.load_molecules(argv[++i])) return 1;
+        }
+        else if (arg == "--molecule" && has_value) {
+            auto molecule = MoleculeTemplate::fromText(argv[++i]);
+            if (!molecule) {
+                std::cerr << "invalid molecule " << argv[i] << "\n";
+                return 1;
+            }
+            world.start_molecules.push_back(*molecule);
+        }
+        else if (arg == "--start-threads" && has_value) world.start_threads = std::stoi(argv[++i]);
+        else if (arg == "--threads" && has_value) world.threads = std::stoi(argv[++i]);
+        else if (arg == "--reorder-threshold" && has_value) world.reorder_threshold = std::stof(argv[++i]);
+        else if (arg == "--types" && has_value) world.start_atoms.resize(std::clamp(std::stoi(argv[++i]), 1, max_types), world.start_atoms.back());
+        else if (arg == "--rules" && has_value) {
+            if (!world.load_rules(argv[++i])) return 1;
+        }
+        else if (arg == "--rule-stats" && has_value) rule_stats_filename = argv[++i];
+        else if (arg == "--rule-stats-interval" && has_value) world.rule_stats_interval = std::stoi(argv[++i]);
+        else if (arg == "--stochastic-rules") world.stochastic_rules = true;
+        else if (arg == "--ensemble" && has_value) ensemble_filename = argv[++i];
+        else if (arg == "--region" && has_value) {
+            auto region = Region::fromText(argv[++i]);
+            if (!region) {
+                std::cerr << "invalid region " << argv[i] << "\n";
+                return 1;
+            }
+            world.regions.push_back(*region);
+        }
+        else if (arg == "--population" && has_value) population_filename = argv[++i];
+        else if (arg == "--population-interval" && has_value) world.population_interval = std::stoi(argv[++i]);
+        else if (arg == "--compact") compact_world = true;
+        else if (arg == "--domains" && has_value) num_domains = std::stoi(argv[++i]);
+        else if (arg == "--processes") domain_processes = true;
+        else if (arg == "--domain-check") domain_check = true;
+        else if (arg == "--domain-dump" && has_value) domain_dump_filename = argv[++i];
+        else if (arg == "--check") check = true;
+        else if (arg == "--check-set" && has_value) {
+            std::string setting = argv[++i];
+            auto equals = setting.find('=');
+            if (equals == std::string::npos) {
+                std::cerr << "expected name=value after --check-set\n";
+                return 1;
+            }
+            check_settings.push_back({setting.substr(0, equals), std::stof(setting.substr(equals+1))});
+            check = true;
+        }
+        else if (arg == "--check-tolerance" && has_value) {
+            check_tolerance = std::stof(argv[++i]);
+            check = true;
+        }
+        else if (arg == "--check-reload" && has_value) {
+            check_reload_interval = std::stoi(argv[++i]);
+            check = true;
+        }
+        else if (arg == "--hash-log" && has_value) hash_log_filename = argv[++i];
+#ifndef HEADLESS
+        else if (arg == "--frames" && has_value) export_options.png_pattern = argv[++i];
+        else if (arg == "--video" && has_value) export_options.raw_filename = argv[++i];
+        else if (arg == "--frame-interval" && has_value) frame_interval = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--frame-size" && has_value && sscanf(argv[i+1], "%dx%d", &export_options.width, &export_options.height) == 2) i++;
+        else if (arg == "--export-threads" && has_value) export_options.threads = std::stoi(argv[++i]);
+#endif
+        else if (arg == "--metrics-port" && has_value) metrics_port = std::stoi(argv[++i]);
+        else if (arg == "--metrics-socket" && has_value) metrics_socket = argv[++i];
+        else if (arg == "--metrics-interval" && has_value) metrics_interval = std::stod(argv[++i]);
+        else {
+            std::cerr << "unknown or incomplete argument " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (!ensemble_filename.empty()) {
+        EnsembleSpec spec;
+        if (!spec.load(ensemble_filename)) return 1;
+        Ensemble ensemble(spec);
+        return ensemble.run() ? 0 : 1;
+    }
+
+    if (check) {
+        return run_headless_check(world, check_settings, check_tolerance, check_reload_interval, steps);
+    }
+
+    if (compact_world) {
+        return run_headless_compact(world, steps, hash_log_filename);
+    }
+
+    if (num_domains > 0) {
+        return run_headless_domains(world, num_domains, domain_processes, domain_check, steps, domain_dump_filename);
+    }
+
+    auto restart_start = std::chrono::high_resolution_clock::now();
+    world.restart();
+    std::chrono::duration<float> restart_duration = std::chrono::high_resolution_clock::now() - restart_start;
+    if (!population_filename.empty() && !world.population_history.open(population_filename, world.population.num_types, world.population.num_states)) {
+        std::cerr << "cannot write " << population_filename << "\n";
+        return 1;
+    }
+    
+    // the state hash of every step, to compare runs of different builds
+    std::ofstream hash_log;
+    if (!hash_log_filename.empty()) {
+        hash_log.open(hash_log_filename);
+    }
+
+#ifndef HEADLESS
+    // frames are drawn and written in the background, see FrameExporter
+    std::unique_ptr<FrameExporter> exporter;
+    if (!export_options.png_pattern.empty() || !export_options.raw_filename.empty()) {
+        TTF_Init();
+        exporter = std::make_unique<FrameExporter>(export_options);
+        if (!exporter->ok()) {
+            std::cerr << "cannot write " << export_options.raw_filename << "\n";
+            return 1;
+        }
+        exporter->add(world);
+    }
+    // with the video on stdout, the report goes to stderr
+    std::ostream& out = (export_options.raw_filename == "-") ? std::cerr : std::cout;
+#else
+    std::ostream& out = std::cout;
+#endif
+    out << world.atoms.size() << " atoms and " << world.bonds.size() << " bonds placed in " << restart_duration.count() * 1000 << " ms\n";
+
+    // scraped while the world runs, see metrics.h
+    std::unique_ptr<MetricsServer> metrics;
+    if (metrics_port > 0 || !metrics_socket.empty()) {
+        metrics = std::make_unique<MetricsServer>(world, metrics_port, metrics_socket);
+        if (!metrics->ok()) return 1;
+        metrics->publish_interval = metrics_interval;
+    }
+
+    auto clock_start = std::chrono::high_resolution_clock::now();
+    for (int i=0;i<steps;++i) {
+        PROFILE_BEGIN_FRAME(world.profiler);
+        world.update();
+        PROFILE_END_FRAME(world.profiler);
+        if (metrics) metrics->publish(world);
+        if (hash_log.is_open()) hash_log << std::dec << world.step_count << " " << std::hex << world.state_hash() << "\n";
+#ifndef HEADLESS
+        if (exporter && (i+1) % frame_interval == 0) exporter->add(world);
+#endif
+    }
+    int failed_writes = 0;
+#ifndef HEADLESS
+    if (exporter) {
+        failed_writes = exporter->finish();
+        out << exporter->frames() << " frames of " << export_options.width << "x" << export_options.height << "\n";
+        if (failed_writes > 0) {
+            std::cerr << failed_writes << " frame writes failed\n";
+        }
+        TTF_Quit();
+    }
+#endif
+    auto clock_end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<float> duration = clock_end - clock_start;
+    
+    out << steps << " steps in " << duration.count() << " s, " 
+        << steps / duration.count() << " steps/s, "
+        << world.atoms.size() << " atoms, " 
+        << world.bonds.size() << " bonds, "
+        << world.clusters.num_clusters << " clusters, largest "
+        << world.clusters.largest() << ", state hash "
+        << std::hex << world.state_hash() << std::dec << "\n";
+
+    // molecules: the size histogram and the most common compositions
+    out << "cluster sizes:";
+    for (int size=1;size<world.clusters.size_histogram.size();++size) {
+        int count = world.clusters.size_histogram[size];
+        if (count > 0) out << " " << size << "x" << count;
+    }
+    out << "\n";
+    auto signatures = world.clusters.signature_counts(world.atoms);
+    for (int i=0;i<signatures.size() && i<10;++i) {
+        out << "  " << signatures[i].first << ": " << signatures[i].second << "\n";
+    }
+    for (auto& region: world.regions) {
+        out << region.toText() << ": " << region.count << " atoms\n";
+    }
+
+    auto memory = world.memory_usage();
+    CompactState compact;
+    compact.encode(world);
+    out << "memory " << memory.total() / 1048576.0 << " MB, "
+        << (world.atoms.empty() ? 0 : memory.atoms / world.atoms.size()) << " bytes per atom, "
+        << (world.bonds.empty() ? 0 : memory.bonds / world.bonds.size()) << " bytes per bond; compact "
+        << compact.bytes() / 1048576.0 << " MB\n";
+    out << world.debug_num_reorders << " atom reorders\n";
+
+    if (!rule_stats_filename.empty()) {
+        std::ofstream file(rule_stats_filename);
+        world.write_rule_stats(file);
+    }
+    return failed_writes > 0 ? 1 : 0;
+}
+
+#ifdef HEADLESS
+int main(int argc, char* argv[]) {
+    return run_headless(argc, argv);
+}
+#else
 int main(int argc, char* argv[]) {
     
+    if (argc > 1 && std::string(argv[1]) == "--headless") {
+        return run_headless(argc, argv);
+    }
+
     SDL_Init(SDL_INIT_VIDEO);
     TTF_Init();
 
@@ -598,7 +1369,4 @@ int main(int argc, char* argv[]) {
     SDL_Quit();
 }
 #endif
- 
-
-
-
+#endif
\ No newline at end of file
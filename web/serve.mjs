@@ -0,0 +1,41 @@
+// A static file server for testing the web builds locally, e.g.
+//   node web/serve.mjs build_web 8080
+// It sends the headers that make the page cross-origin isolated, which browsers require
+// for SharedArrayBuffer and so for the multithreaded build; see Makefile_web.
+// Checked to serve files with these headers; not yet used with a real web-mt build (unverified).
+
+import { createServer } from 'node:http';
+import { readFile } from 'node:fs/promises';
+import { extname, join, normalize } from 'node:path';
+
+const root = process.argv[2] ?? 'web';
+const port = Number(process.argv[3] ?? 8080);
+
+const types = {
+  '.html': 'text/html',
+  '.js': 'text/javascript',
+  '.mjs': 'text/javascript',
+  '.wasm': 'application/wasm',
+  '.data': 'application/octet-stream',
+};
+
+createServer(async (request, response) => {
+  let path = decodeURIComponent(new URL(request.url, 'http://localhost').pathname);
+  if (path.endsWith('/')) path += 'index.html';
+  const file = join(root, normalize(path).replace(/^(\.\.[\/\\])+/, ''));
+  try {
+    const data = await readFile(file);
+    response.writeHead(200, {
+      'Content-Type': types[extname(file)] ?? 'application/octet-stream',
+      'Cross-Origin-Opener-Policy': 'same-origin',
+      'Cross-Origin-Embedder-Policy': 'require-corp',
+    });
+    response.end(data);
+  }
+  catch {
+    response.writeHead(404);
+    response.end('not found');
+  }
+}).listen(port, () => {
+  console.log(`serving ${root} on http://localhost:${port}/`);
+});